@@ -0,0 +1,162 @@
+// Times the PPU's LCDC-specialized line kernels against the generic kernel, which checks the
+// same LCDC bits at runtime, for every combination of the bits they're specialized on.
+// Build with -DHELIAGE_BUILD_BENCHMARKS=ON. Any boot ROM and cartridge will do, VRAM and the
+// registers are filled in by the benchmark.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fmt/core.h>
+#include <random>
+#include <string>
+#include "bootrom.h"
+#include "cartridge.h"
+#include "gb.h"
+#include "ppu.h"
+
+static constexpr u32 FRAMES = 200;
+
+// The benchmark doesn't run frames to completion, so these are never called.
+void HandleEvents([[maybe_unused]] Joypad* joypad) {
+}
+
+void DrawFramebuffer([[maybe_unused]] const PPU::RenderTarget& frame) {
+}
+
+struct LineKernelBenchmark {
+    using Flags = PPU::LineKernelFlags;
+
+    PPU& ppu;
+    std::mt19937 rng { 1234 };
+    std::array<PPU::LineState, 144> lines {};
+
+    explicit LineKernelBenchmark(GB& gb) : ppu(*gb.GetPPU()) {
+        // Random tiles and tile maps. Nothing is drawing yet, so VRAM is accessible.
+        for (u16 addr = 0x8000; addr < 0xA000; addr++) {
+            gb.GetBus()->Write8(addr, rng(), false);
+        }
+
+        ppu.SetBGWindowPalette(0xE4);
+        ppu.SetOBP0(0xD2);
+        ppu.SetOBP1(0x1B);
+    }
+
+    void SetUpLines(u8 kernel_flags) {
+        u8 lcdc = 0x80;
+        lcdc |= (kernel_flags & Flags::Background) ? 0x01 : 0;
+        lcdc |= (kernel_flags & Flags::Sprites) ? 0x02 : 0;
+        lcdc |= (kernel_flags & Flags::TallSprites) ? 0x04 : 0;
+        lcdc |= (kernel_flags & Flags::SignedTiles) ? 0 : 0x10;
+        lcdc |= (kernel_flags & Flags::Window) ? 0x20 : 0;
+
+        for (u8 ly = 0; ly < 144; ly++) {
+            PPU::LineState& line = lines[ly];
+            line = {};
+            line.ly = ly;
+            line.lcdc = lcdc;
+            line.scx = rng();
+            line.scy = rng();
+            line.wx = 87;
+            line.wy = 72;
+            line.palette = ppu.composition_lut;
+
+            line.sprite_count = 10;
+            for (PPU::Sprite& sprite : line.sprites) {
+                sprite.y = ly + 16 - (rng() % 8);
+                sprite.x = rng() % 168;
+                sprite.tile_index = rng();
+                sprite.use_obp1 = rng() % 2;
+                sprite.flip_x = rng() % 2;
+                sprite.priority = rng() % 4 == 0;
+            }
+        }
+    }
+
+    // Draws every line of a frame with one kernel, as if nothing could be reused.
+    double Measure(u8 kernel_index) {
+        const PPU::LineKernel kernel = PPU::line_kernels[kernel_index];
+        const auto start = std::chrono::steady_clock::now();
+        for (u32 frame = 0; frame < FRAMES; frame++) {
+            ppu.InvalidateLineSignatures();
+            ppu.window_line_counter = 0;
+            for (const PPU::LineState& line : lines) {
+                (ppu.*kernel)(line);
+            }
+        }
+        const auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count() / (FRAMES * 144);
+    }
+
+    static std::string Describe(u8 kernel_flags) {
+        std::string name;
+        name += (kernel_flags & Flags::Background) ? "BG " : "-- ";
+        name += (kernel_flags & Flags::Window) ? "WIN " : "--- ";
+        name += (kernel_flags & Flags::Sprites) ? "OBJ " : "--- ";
+        name += (kernel_flags & Flags::TallSprites) ? "8x16 " : "8x8  ";
+        name += (kernel_flags & Flags::SignedTiles) ? "0x8800" : "0x8000";
+        return name;
+    }
+
+    int Run() {
+        fmt::print("line kernels, {} frames per configuration\n", FRAMES);
+        fmt::print("{:<26} {:>14} {:>14}\n", "configuration", "generic", "specialized");
+
+        for (u8 kernel_flags = 0; kernel_flags < Flags::Generic; kernel_flags++) {
+            SetUpLines(kernel_flags);
+
+            // On DMG, LCDC bit 0 hides the window along with the background, so these kernels are
+            // never picked. The generic kernel has to draw those lines as if the window were off,
+            // sprites behind the background included.
+            if ((kernel_flags & Flags::Window) && !(kernel_flags & Flags::Background)) {
+                Measure(Flags::Generic);
+                const PPU::Framebuffer reference = ppu.framebuffer;
+                for (PPU::LineState& line : lines) {
+                    line.lcdc &= ~0x20;
+                }
+                Measure(Flags::Generic);
+                if (ppu.framebuffer != reference) {
+                    fmt::print("{}: the window shows up with the background disabled\n", Describe(kernel_flags));
+                    return 1;
+                }
+                continue;
+            }
+
+            // Both kernels have to draw the same thing.
+            Measure(Flags::Generic);
+            const PPU::Framebuffer reference = ppu.framebuffer;
+            Measure(kernel_flags);
+            if (ppu.framebuffer != reference) {
+                fmt::print("{}: specialized kernel output doesn't match the generic kernel\n", Describe(kernel_flags));
+                return 1;
+            }
+
+            // Alternate between the two and keep the best time of each, to even out noise.
+            double generic = 1e9;
+            double specialized = 1e9;
+            for (u32 run = 0; run < 5; run++) {
+                generic = std::min(generic, Measure(Flags::Generic));
+                specialized = std::min(specialized, Measure(kernel_flags));
+            }
+            fmt::print("{:<26} {:>8.1f} ns/line {:>8.1f} ns/line  ({:.2f}x)\n",
+                       Describe(kernel_flags), generic, specialized, generic / specialized);
+        }
+
+        return 0;
+    }
+};
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        printf("usage: %s <bootrom> <cartridge>\n", argv[0]);
+        return 1;
+    }
+
+    std::filesystem::path bootrom_path = argv[1];
+    std::filesystem::path cart_path = argv[2];
+    BootROM bootrom(bootrom_path);
+    Cartridge cartridge(cart_path);
+    GB gb(bootrom, cartridge);
+
+    return LineKernelBenchmark(gb).Run();
+}
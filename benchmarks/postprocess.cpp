@@ -0,0 +1,198 @@
+// Times the post-processor on Game Boy-like frames for every scaler, with and without LCD
+// ghosting, on different numbers of worker threads, and checks the SIMD kernels against the
+// scalar ones. Post-processing runs on the emulator thread once per frame, so every scaler has
+// to stay under the 1 ms budget to never hold up emulation.
+// Build with -DHELIAGE_BUILD_BENCHMARKS=ON.
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fmt/core.h>
+#include <random>
+#include <vector>
+#include "postprocess.h"
+
+static constexpr u32 FRAMES = 1000;
+static constexpr double BUDGET_MS = 1.0;
+
+static u32 GetARGBColor(u8 shade) {
+    u8 color = ~(shade * 0x55);
+    return 0xFF << 24 | color << 16 | color << 8 | color;
+}
+
+// A frame made of 8x8 tiles drawn from a small tile set, so it has the long runs and staircase
+// edges the scalers are made for instead of noise.
+static std::vector<u32> MakeFrame(std::mt19937& rng) {
+    std::array<std::array<u8, 64>, 16> tiles;
+    for (auto& tile : tiles) {
+        const u8 shade = rng() % 4;
+        for (u8& pixel : tile) {
+            pixel = (rng() % 4 == 0) ? rng() % 4 : shade;
+        }
+    }
+
+    std::vector<u32> frame(160 * 144);
+    for (u32 tile_y = 0; tile_y < 18; tile_y++) {
+        for (u32 tile_x = 0; tile_x < 20; tile_x++) {
+            const auto& tile = tiles[rng() % tiles.size()];
+            for (u32 y = 0; y < 8; y++) {
+                for (u32 x = 0; x < 8; x++) {
+                    frame[(tile_y * 8 + y) * 160 + tile_x * 8 + x] = GetARGBColor(tile[y * 8 + x]);
+                }
+            }
+        }
+    }
+    return frame;
+}
+
+#if defined(__SSE2__)
+// Runs a scalar and a SIMD row kernel over padded copies of a frame and compares their output.
+template <typename Pixel>
+static bool CheckKernels(const std::vector<u32>& frame) {
+    constexpr u32 padding = 16 / sizeof(Pixel);
+    constexpr u32 pitch = padding + 160 + padding;
+    std::vector<Pixel> source(pitch * 144);
+    for (u32 y = 0; y < 144; y++) {
+        Pixel* row = &source[y * pitch + padding];
+        for (u32 x = 0; x < 160; x++) {
+            row[x] = static_cast<Pixel>(frame[y * 160 + x] * 0x9E3779B1u);
+        }
+        row[-2] = row[-1] = row[0];
+        row[160] = row[161] = row[159];
+    }
+
+    std::vector<Pixel> scalar(160 * 3 * 3);
+    std::vector<Pixel> simd(160 * 3 * 3);
+    for (u32 y = 0; y < 144; y++) {
+        const Pixel* above = &source[(y == 0 ? 0 : y - 1) * pitch + padding];
+        const Pixel* row = &source[y * pitch + padding];
+        const Pixel* below = &source[(y == 143 ? y : y + 1) * pitch + padding];
+        const Pixel* above2 = &source[(y < 2 ? 0 : y - 2) * pitch + padding];
+        const Pixel* below2 = &source[std::min(y + 2, 143u) * pitch + padding];
+
+        PostProcess::Scale2xRowScalar(above, row, below, 160, &scalar[0], &scalar[320]);
+        PostProcess::Scale2xRowSSE2(above, row, below, 160, &simd[0], &simd[320]);
+        if (std::memcmp(scalar.data(), simd.data(), 640 * sizeof(Pixel)) != 0) {
+            fmt::print("SSE2 Scale2x doesn't match the scalar version ({}-byte pixels, row {})\n", sizeof(Pixel), y);
+            return false;
+        }
+
+        PostProcess::Scale3xRowScalar(above, row, below, 160, &scalar[0], &scalar[480], &scalar[960]);
+        PostProcess::Scale3xRowSSE2(above, row, below, 160, &simd[0], &simd[480], &simd[960]);
+        if (std::memcmp(scalar.data(), simd.data(), 1440 * sizeof(Pixel)) != 0) {
+            fmt::print("SSE2 Scale3x doesn't match the scalar version ({}-byte pixels, row {})\n", sizeof(Pixel), y);
+            return false;
+        }
+
+        if constexpr (sizeof(Pixel) == 4) {
+            PostProcess::XBR2xRowScalar(above2, above, row, below, below2, 160, &scalar[0], &scalar[320]);
+            PostProcess::XBR2xRowSSE2(above2, above, row, below, below2, 160, &simd[0], &simd[320]);
+            if (std::memcmp(scalar.data(), simd.data(), 640 * sizeof(Pixel)) != 0) {
+                fmt::print("SSE2 xBR 2x doesn't match the scalar version (row {})\n", y);
+                return false;
+            }
+        }
+
+        std::memcpy(scalar.data(), below, 160 * sizeof(Pixel));
+        std::memcpy(simd.data(), below, 160 * sizeof(Pixel));
+        PostProcess::GhostRowScalar(row, scalar.data(), 160);
+        PostProcess::GhostRowSSE2(row, simd.data(), 160);
+        if (std::memcmp(scalar.data(), simd.data(), 160 * sizeof(Pixel)) != 0) {
+            fmt::print("SSE2 ghosting doesn't match the scalar version ({}-byte pixels, row {})\n", sizeof(Pixel), y);
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+int main() {
+    std::mt19937 rng(1234);
+    std::array<std::vector<u32>, 4> frames;
+    for (auto& frame : frames) {
+        frame = MakeFrame(rng);
+    }
+
+#if defined(__SSE2__)
+    if (!CheckKernels<u32>(frames[0]) || !CheckKernels<u16>(frames[0]) || !CheckKernels<u8>(frames[0])) {
+        return 1;
+    }
+#endif
+
+    const PostProcessor::Scaler scalers[] = {
+        PostProcessor::Scaler::None,
+        PostProcessor::Scaler::Scale2x,
+        PostProcessor::Scaler::Scale3x,
+        PostProcessor::Scaler::Scale4x,
+        PostProcessor::Scaler::XBR2x,
+    };
+    // The budget is checked with the default worker count, which depends on the machine.
+    std::vector<u32> worker_counts = { 0, 1, 3 };
+    if (std::find(worker_counts.begin(), worker_counts.end(), PostProcessor::GetDefaultWorkerCount()) == worker_counts.end()) {
+        worker_counts.push_back(PostProcessor::GetDefaultWorkerCount());
+    }
+
+    // Every thread count has to produce the same thing as doing it all on one thread.
+    std::vector<u32> reference(640 * 576);
+    std::vector<u32> output(640 * 576);
+    for (const PostProcessor::Scaler scaler : scalers) {
+        for (const u32 workers : worker_counts) {
+            PostProcessor post_processor(workers);
+            post_processor.SetScaler(scaler);
+            post_processor.SetGhostingEnabled(true);
+            const u32 scale = post_processor.GetScale();
+            std::vector<u32>& out = (workers == 0) ? reference : output;
+            for (const auto& frame : frames) {
+                post_processor.Process({ (u8*)frame.data(), 160 * 4 }, PPU::PixelFormat::ARGB8888, { (u8*)out.data(), 160 * scale * 4 });
+            }
+            if (workers != 0 && output != reference) {
+                fmt::print("{} workers don't produce the same frame as one thread ({})\n", workers, PostProcessor::GetName(scaler));
+                return 1;
+            }
+        }
+    }
+
+    fmt::print("ARGB8888, {} frames, hardware threads: {}\n", FRAMES, std::thread::hardware_concurrency());
+    fmt::print("{:<10} {:<10} {:>8} {:>12}\n", "scaler", "ghosting", "workers", "ms/frame");
+
+    bool over_budget = false;
+    for (const PostProcessor::Scaler scaler : scalers) {
+        for (const bool ghosting : { false, true }) {
+            if (scaler == PostProcessor::Scaler::None && !ghosting) {
+                continue;
+            }
+
+            for (const u32 workers : worker_counts) {
+                PostProcessor post_processor(workers);
+                post_processor.SetScaler(scaler);
+                post_processor.SetGhostingEnabled(ghosting);
+                const u32 scale = post_processor.GetScale();
+                const PPU::RenderTarget target { (u8*)output.data(), 160 * scale * 4 };
+
+                const auto start = std::chrono::steady_clock::now();
+                for (u32 frame = 0; frame < FRAMES; frame++) {
+                    const auto& input = frames[frame % frames.size()];
+                    post_processor.Process({ (u8*)input.data(), 160 * 4 }, PPU::PixelFormat::ARGB8888, target);
+                }
+                const auto end = std::chrono::steady_clock::now();
+
+                const double ms_per_frame = std::chrono::duration<double, std::milli>(end - start).count() / FRAMES;
+                fmt::print("{:<10} {:<10} {:>8} {:>12.3f}", PostProcessor::GetName(scaler), ghosting ? "on" : "off", workers, ms_per_frame);
+                if (workers == PostProcessor::GetDefaultWorkerCount() && ms_per_frame > BUDGET_MS) {
+                    fmt::print("  over the {:.1f} ms budget", BUDGET_MS);
+                    over_budget = true;
+                }
+                fmt::print("\n");
+            }
+        }
+    }
+
+    // Keep the compiler from throwing the work away.
+    u32 checksum = 0;
+    for (u32 pixel : output) {
+        checksum += pixel;
+    }
+    fmt::print("checksum {}\n", checksum);
+
+    return over_budget ? 1 : 0;
+}
@@ -0,0 +1,237 @@
+// Compares the old pixel-at-a-time background renderer against the tile row kernels,
+// and the scalar and SIMD line composition kernels against each other.
+// Build with -DHELIAGE_BUILD_BENCHMARKS=ON, optionally with HELIAGE_NATIVE_OPTIMIZATIONS
+// to get the SSSE3/BMI2 kernels.
+
+#include <chrono>
+#include <cstring>
+#include <fmt/core.h>
+#include <random>
+#include <vector>
+#include "scanline.h"
+
+static constexpr u32 FRAMES = 2000;
+
+struct VRAM {
+    std::array<u8, 0x1800> tile_data;
+    std::array<u8, 0x400> tile_map;
+};
+
+// The renderer as it was before tile row rendering: a decoded tile cache of one byte per
+// pixel, and a tile map lookup and palette switch for every pixel.
+struct PerPixelRenderer {
+    u8 tiles[384][8][8];
+    u8 palette_zero, palette_one, palette_two, palette_three;
+
+    explicit PerPixelRenderer(const VRAM& vram, u8 palette) {
+        for (u16 index = 0; index < 0x1800; index += 2) {
+            const u8 byte1 = vram.tile_data[index];
+            const u8 byte2 = vram.tile_data[index + 1];
+            for (u8 col = 0; col < 8; col++) {
+                tiles[index / 16][(index % 16) / 2][col] = (((byte2 >> (7 - col)) & 0b1) << 1) | ((byte1 >> (7 - col)) & 0b1);
+            }
+        }
+
+        palette_three = (palette >> 6) & 0b11;
+        palette_two = (palette >> 4) & 0b11;
+        palette_one = (palette >> 2) & 0b11;
+        palette_zero = palette & 0b11;
+    }
+
+    u8 GetColor(u8 color) const {
+        switch (color) {
+            case 0b00: return palette_zero;
+            case 0b01: return palette_one;
+            case 0b10: return palette_two;
+            default: return palette_three;
+        }
+    }
+
+    void Render(const VRAM& vram, u8 ly, u8 scx, u8 scy, u8* out) const {
+        for (u8 screen_x = 0; screen_x < 160; screen_x++) {
+            const u16 bg_x = (screen_x + scx) % 256;
+            const u16 bg_y = (ly + scy) % 256;
+            const u16 tile_id = vram.tile_map[(bg_x / 8) + (bg_y / 8 * 32)];
+            out[screen_x] = GetColor(tiles[tile_id][bg_y % 8][bg_x % 8]);
+        }
+    }
+};
+
+// What the frontends used to do to every pixel of every frame.
+static u32 GetARGBColor(u8 shade) {
+    u8 color = ~(shade * 0x55);
+    return 0xFF << 24 | color << 16 | color << 8 | color;
+}
+
+template <typename Pixel, void (*ApplyPalette)(u64, const Scanline::PaletteLUT&, Pixel*)>
+static void RenderTileRows(const VRAM& vram, const Scanline::PaletteLUT& palette, u8 ly, u8 scx, u8 scy, Pixel* out) {
+    const u8 bg_y = ly + scy;
+    std::array<Pixel, 21 * 8> line;
+    for (u8 i = 0; i < 21; i++) {
+        const u16 tile_id = vram.tile_map[((scx / 8 + i) % 32) + (bg_y / 8 * 32)];
+        const u16 row = tile_id * 16 + (bg_y % 8) * 2;
+        ApplyPalette(Scanline::DecodeTileRow(vram.tile_data[row], vram.tile_data[row + 1]), palette, &line[i * 8]);
+    }
+
+    std::memcpy(out, &line[scx % 8], 160 * sizeof(Pixel));
+}
+
+template <typename F>
+static double Measure(const char* name, F&& render_frame, double baseline_ns) {
+    const auto start = std::chrono::steady_clock::now();
+    for (u32 frame = 0; frame < FRAMES; frame++) {
+        render_frame(frame);
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    const double ns_per_line = std::chrono::duration<double, std::nano>(end - start).count() / (FRAMES * 144);
+    fmt::print("{:<28} {:>8.1f} ns/line", name, ns_per_line);
+    if (baseline_ns > 0) {
+        fmt::print("  ({:.2f}x)", baseline_ns / ns_per_line);
+    }
+    fmt::print("\n");
+    return ns_per_line;
+}
+
+int main() {
+    std::mt19937 rng(1234);
+    VRAM vram;
+    for (u8& byte : vram.tile_data) {
+        byte = rng();
+    }
+    for (u8& byte : vram.tile_map) {
+        byte = rng();
+    }
+
+    const u8 palette_value = 0xE4;
+    Scanline::PaletteLUT palette {};
+    Scanline::PaletteLUT argb_palette {};
+    for (u8 i = 0; i < 4; i++) {
+        const u8 shade = (palette_value >> (i * 2)) & 0b11;
+        Scanline::SetPaletteEntry<u8>(palette, i, shade);
+        Scanline::SetPaletteEntry<u32>(argb_palette, i, GetARGBColor(shade));
+    }
+
+    PerPixelRenderer per_pixel(vram, palette_value);
+    std::vector<u8> framebuffer(160 * 144);
+    std::vector<u8> reference(160 * 144);
+    std::vector<u32> argb_framebuffer(160 * 144);
+    std::vector<u32> argb_reference(160 * 144);
+
+    // Make sure everything renders the same thing before timing it.
+    for (u32 frame = 0; frame < 16; frame++) {
+        const u8 scx = frame * 3;
+        const u8 scy = frame * 5;
+        for (u8 ly = 0; ly < 144; ly++) {
+            per_pixel.Render(vram, ly, scx, scy, &reference[ly * 160]);
+            RenderTileRows<u8, Scanline::ApplyPalette<u8>>(vram, palette, ly, scx, scy, &framebuffer[ly * 160]);
+            RenderTileRows<u32, Scanline::ApplyPalette<u32>>(vram, argb_palette, ly, scx, scy, &argb_framebuffer[ly * 160]);
+        }
+        for (u32 i = 0; i < reference.size(); i++) {
+            argb_reference[i] = GetARGBColor(reference[i]);
+        }
+        if (framebuffer != reference || argb_framebuffer != argb_reference) {
+            fmt::print("tile row renderer output doesn't match the per-pixel renderer (scx={}, scy={})\n", scx, scy);
+            return 1;
+        }
+    }
+
+    fmt::print("background scanline, {} frames, scrolling\n", FRAMES);
+
+    const double baseline = Measure("per-pixel", [&](u32 frame) {
+        for (u8 ly = 0; ly < 144; ly++) {
+            per_pixel.Render(vram, ly, frame, frame / 2, &framebuffer[ly * 160]);
+        }
+    }, 0);
+
+    Measure("tile rows (scalar palette)", [&](u32 frame) {
+        for (u8 ly = 0; ly < 144; ly++) {
+            RenderTileRows<u8, Scanline::ApplyPaletteScalar<u8>>(vram, palette, ly, frame, frame / 2, &framebuffer[ly * 160]);
+        }
+    }, baseline);
+
+#if defined(__SSSE3__)
+    Measure("tile rows (SSSE3 palette)", [&](u32 frame) {
+        for (u8 ly = 0; ly < 144; ly++) {
+            RenderTileRows<u8, Scanline::ApplyPaletteSSSE3<u8>>(vram, palette, ly, frame, frame / 2, &framebuffer[ly * 160]);
+        }
+    }, baseline);
+#endif
+
+    // Rendering straight to ARGB8888 versus rendering shades and converting them afterwards.
+    fmt::print("\nARGB8888 output, {} frames, scrolling\n", FRAMES);
+
+    const double argb_baseline = Measure("per-pixel + conversion", [&](u32 frame) {
+        for (u8 ly = 0; ly < 144; ly++) {
+            per_pixel.Render(vram, ly, frame, frame / 2, &framebuffer[ly * 160]);
+        }
+        for (u32 i = 0; i < framebuffer.size(); i++) {
+            argb_framebuffer[i] = GetARGBColor(framebuffer[i]);
+        }
+    }, 0);
+
+    Measure("tile rows (scalar palette)", [&](u32 frame) {
+        for (u8 ly = 0; ly < 144; ly++) {
+            RenderTileRows<u32, Scanline::ApplyPaletteScalar<u32>>(vram, argb_palette, ly, frame, frame / 2, &argb_framebuffer[ly * 160]);
+        }
+    }, argb_baseline);
+
+#if defined(__SSSE3__)
+    Measure("tile rows (SSSE3 palette)", [&](u32 frame) {
+        for (u8 ly = 0; ly < 144; ly++) {
+            RenderTileRows<u32, Scanline::ApplyPaletteSSSE3<u32>>(vram, argb_palette, ly, frame, frame / 2, &argb_framebuffer[ly * 160]);
+        }
+    }, argb_baseline);
+#endif
+
+    // Composing a background line and a sprite line, with about a quarter of the pixels covered by sprites.
+    fmt::print("\nline composition, {} frames\n", FRAMES);
+
+    Scanline::CompositionLUT composition_lut {};
+    for (u8 color = 0; color < 12; color++) {
+        Scanline::SetCompositionEntry<u32>(composition_lut, color, GetARGBColor(color % 4));
+    }
+
+    alignas(16) std::array<u8, 160 * 144> bg_lines;
+    alignas(16) std::array<u8, 160 * 144> obj_lines;
+    for (u32 i = 0; i < bg_lines.size(); i++) {
+        bg_lines[i] = rng() % 4;
+        obj_lines[i] = (rng() % 4 == 0) ? (4 + rng() % 8) | (rng() % 2 ? Scanline::OBJ_BEHIND_BG : 0) : 0;
+    }
+
+#if defined(__SSSE3__)
+    std::vector<u32> composed_reference(160 * 144);
+    Scanline::ComposeLineScalar(bg_lines.data(), obj_lines.data(), composition_lut, composed_reference.data(), 160 * 144);
+    Scanline::ComposeLineSSSE3(bg_lines.data(), obj_lines.data(), composition_lut, argb_framebuffer.data(), 160 * 144);
+    if (argb_framebuffer != composed_reference) {
+        fmt::print("SSSE3 line composition doesn't match the scalar version\n");
+        return 1;
+    }
+#endif
+
+    [[maybe_unused]] const double compose_baseline = Measure("scalar (ARGB8888)", [&](u32) {
+        for (u8 ly = 0; ly < 144; ly++) {
+            Scanline::ComposeLineScalar(&bg_lines[ly * 160], &obj_lines[ly * 160], composition_lut, &argb_framebuffer[ly * 160], 160);
+        }
+    }, 0);
+
+#if defined(__SSSE3__)
+    Measure("SSSE3 (ARGB8888)", [&](u32) {
+        for (u8 ly = 0; ly < 144; ly++) {
+            Scanline::ComposeLineSSSE3(&bg_lines[ly * 160], &obj_lines[ly * 160], composition_lut, &argb_framebuffer[ly * 160], 160);
+        }
+    }, compose_baseline);
+#endif
+
+    // Keep the compiler from throwing the work away.
+    u32 checksum = 0;
+    for (u8 pixel : framebuffer) {
+        checksum += pixel;
+    }
+    for (u32 pixel : argb_framebuffer) {
+        checksum += pixel;
+    }
+    fmt::print("checksum {}\n", checksum);
+
+    return 0;
+}
@@ -4,7 +4,6 @@
 #include "logging.h"
 
 BootROM::BootROM(std::filesystem::path& bootrom_path) {
-    bootrom.fill(0xFF);
     LoadBootROM(bootrom_path);
 }
 
@@ -13,7 +12,8 @@ bool BootROM::CheckBootROM(std::filesystem::path& bootrom_path) {
         return false;
     }
 
-    if (std::filesystem::file_size(bootrom_path) != BOOTROM_SIZE) {
+    const auto size = std::filesystem::file_size(bootrom_path);
+    if (size != DMG_BOOTROM_SIZE && size != CGB_BOOTROM_SIZE) {
         return false;
     }
 
@@ -24,8 +24,12 @@ void BootROM::LoadBootROM(std::filesystem::path& bootrom_path) {
     std::ifstream stream(bootrom_path.string().c_str(), std::ios::binary);
     ASSERT_MSG(stream.is_open(), "could not open bootROM: {}", bootrom_path.string().c_str());
 
+    // Anything that isn't a CGB boot ROM is treated as a DMG one, so a bad file still fails CheckBootROM
+    // instead of being read out of bounds.
+    const auto size = std::filesystem::file_size(bootrom_path);
+    bootrom.assign(size == CGB_BOOTROM_SIZE ? CGB_BOOTROM_SIZE : DMG_BOOTROM_SIZE, 0xFF);
     stream.read(reinterpret_cast<char*>(bootrom.data()), bootrom.size());
-    LINFO("bootrom: loaded {} bytes", std::filesystem::file_size(bootrom_path));
+    LINFO("bootrom: loaded {} bytes ({})", size, IsCGB() ? "CGB" : "DMG");
 }
 
 u8 BootROM::Read(u16 addr) {
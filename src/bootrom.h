@@ -1,11 +1,13 @@
 #pragma once
 
-#include <array>
 #include <filesystem>
+#include <vector>
 #include "common/types.h"
 
-// TODO: CGB?
-constexpr u32 BOOTROM_SIZE = 256; // 256 bytes
+constexpr u32 DMG_BOOTROM_SIZE = 256; // 256 bytes
+// Mapped at 0x0000-0x00FF and 0x0200-0x08FF. The file includes the gap at 0x0100-0x01FF,
+// where the cartridge header shows through.
+constexpr u32 CGB_BOOTROM_SIZE = 2304; // 2.25KB
 
 class BootROM {
 public:
@@ -13,7 +15,12 @@ public:
     bool CheckBootROM(std::filesystem::path& bootrom_path);
     void LoadBootROM(std::filesystem::path& bootrom_path);
 
+    // A CGB boot ROM means the system is a CGB, whatever cartridge is inserted.
+    bool IsCGB() const { return bootrom.size() == CGB_BOOTROM_SIZE; }
+    // Whether the boot ROM covers an address while it's enabled.
+    bool IsMapped(u16 addr) const { return addr < 0x0100 || (IsCGB() && addr >= 0x0200 && addr < CGB_BOOTROM_SIZE); }
+
     u8 Read(u16 addr);
 private:
-    std::array<u8, BOOTROM_SIZE> bootrom;
+    std::vector<u8> bootrom;
 };
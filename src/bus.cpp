@@ -1,10 +1,21 @@
+#include <algorithm>
 #include <fmt/os.h>
 #include "bus.h"
 #include "logging.h"
+#include "sm83.h"
 
-Bus::Bus(BootROM& bootrom, Cartridge& cartridge, Joypad& joypad, PPU& ppu, Timer& timer)
-    : bootrom(bootrom), cartridge(cartridge), joypad(joypad), ppu(ppu), timer(timer) {
+Bus::Bus(BootROM& bootrom, Cartridge& cartridge, Joypad& joypad, PPU& ppu, SM83& sm83, Timer& timer)
+    : cartridge_ram(cartridge.GetRAMSize(), cartridge.HasBattery(), cartridge.GetSavePath()),
+      bootrom(bootrom), cartridge(cartridge), joypad(joypad), ppu(ppu), sm83(sm83), timer(timer) {
     LoadInitialValues();
+
+    if (cartridge.RequiresCGB() && !bootrom.IsCGB()) {
+        LWARN("bus: the cartridge only works on a CGB, but the boot ROM is a DMG one");
+    }
+
+#ifdef HELIAGE_MEMORY_PROFILING_PER_FRAME
+    memory_profiler.SetFrameLog("memory_profile_frames.csv");
+#endif
 }
 
 void Bus::LoadInitialValues() {
@@ -13,87 +24,129 @@ void Bus::LoadInitialValues() {
     oam.fill(0xFF);
     io.fill(0xFF);
     hram.fill(0xFF);
-    cartridge_ram.fill(0xFF);
 
     // Some addresses need to start at a different value than 0xFF.
     // For example, the interrupt registers need to be zero at startup,
     // otherwise they would be able to execute any interrupt once
     // interrupts are enabled if these registers weren't zeroed out before.
     io[0x0F] = 0xE0;
+
+    // The CGB registers that read back what was written start out cleared.
+    if (bootrom.IsCGB()) {
+        io[0x56] = 0x00;
+        io[0x70] = 0x00;
+        std::fill(&io[0x72], &io[0x76], 0x00);
+    }
+
+    open_bus_page.fill(0xFF);
+    MapFixedPages();
 }
 
-u8 Bus::Read8(u16 addr, bool affect_timer) {
-    const u8 value = [&]() -> u8 {
-        switch (addr) {
-            case 0x0000 ... 0x7FFF:
-                if (addr < 0x0100 && boot_rom_enabled) {
-                    return bootrom.Read(addr);
-                }
+void Bus::MapReadPage(u8 page, const u8* memory) {
+    mapped_read_pages[page] = memory;
+    read_pages[page] = watched_read_pages[page] ? nullptr : memory;
+}
 
-#define CART_IS_MBC1() (mbc_type >= 0x01 && mbc_type <= 0x03)
-#define CART_IS_MBC3() (mbc_type >= 0x0F && mbc_type <= 0x13)
+void Bus::MapWritePage(u8 page, u8* memory) {
+    mapped_write_pages[page] = memory;
+    write_pages[page] = watched_write_pages[page] ? nullptr : memory;
+}
 
-                if (addr >= 0x4000) {
-                    u8 mbc_type = cartridge.GetMBCType();
-                    u16 rom_bank = 0x001;
-                    if (CART_IS_MBC1()) {
-                        rom_bank = ((mbc1_bank2 & 3) << 5) | (mbc1_bank1 & 0x1F);
-                    } else if (CART_IS_MBC3()) {
-                        rom_bank = mbc3_rom_bank;
-                    }
-                    return cartridge.Read((addr & 0x3FFF) + rom_bank * 0x4000);
-                }
+void Bus::MapFixedPages() {
+    RebuildROMPages();
+    RemapROM();
 
-                return cartridge.Read(addr);
+    // WRAM bank 0, and its echo
+    for (u16 page = 0xC0; page < 0xD0; page++) {
+        MapReadPage(page, &wram[(page - 0xC0) << 8]);
+        MapWritePage(page, &wram[(page - 0xC0) << 8]);
+        MapReadPage(page + 0x20, &wram[(page - 0xC0) << 8]);
+        MapWritePage(page + 0x20, &wram[(page - 0xC0) << 8]);
+    }
 
-            case 0x8000 ... 0x9FFF:
-                // LDEBUG("bus: reading 0x{:02X} from 0x{:04X} (VRAM)", vram[addr - 0x8000], addr);
-                return vram[addr - 0x8000];
+    RemapWRAM();
+    RemapVRAM();
+    RemapOAM();
+}
 
-            case 0xA000 ... 0xBFFF:
-                if (!mbc_ram_enabled) {
-                    // LWARN("bus: attempted to read from cartridge RAM while it is disabled (from 0x{:04X})", addr);
-                    return 0xFF;
-                }
+void Bus::RebuildROMPages() {
+    const std::span<const u8> rom = cartridge.GetROM();
+    rom_overlay = cheats.BuildROMOverlay(rom);
 
-                LDEBUG("bus: reading 0x{:02X} from 0x{:04X} (Cartridge RAM)", cartridge_ram[addr - 0xA000], addr);
-                return cartridge_ram[addr - 0xA000];
+    rom_pages.resize(rom.size() >> 8);
+    for (u32 page = 0; page < rom_pages.size(); page++) {
+        auto overlay_page = rom_overlay.find(page);
+        rom_pages[page] = (overlay_page != rom_overlay.end()) ? overlay_page->second.data() : &rom[page << 8];
+    }
+}
 
-            case 0xC000 ... 0xDFFF:
-                // LDEBUG("bus: reading 0x{:02X} from 0x{:04X} (WRAM)", wram[addr - 0xC000], addr);
-                return wram[addr - 0xC000];
+void Bus::RemapROM() {
+    // The boot ROM sits on top of the first page (and 0x0200-0x08FF for a CGB one) until it's disabled.
+    for (u16 page = 0x00; page < 0x40; page++) {
+        MapReadPage(page, (boot_rom_enabled && bootrom.IsMapped(page << 8)) ? nullptr : rom_pages[page]);
+    }
 
-            case 0xE000 ... 0xFDFF:
-                // LWARN("bus: reading from echo RAM (0x{:02X} from 0x{:04X})", wram[addr - 0xE000], addr);
-                return wram[addr - 0xE000];
+    const u32 bank_page = GetROMBank() * 0x40;
+    for (u16 page = 0x40; page < 0x80; page++) {
+        MapReadPage(page, rom_pages[bank_page + (page - 0x40)]);
+    }
+}
 
-            case 0xFE00 ... 0xFE9F:
-                if (oam_dma.active) {
-                    return 0xFF;
-                }
+void Bus::RemapVRAM() {
+    // Writes always take the slow path, so the PPU can finish any lines it hasn't drawn yet
+    // and mark tiles dirty before VRAM changes.
+    for (u16 page = 0x80; page < 0xA0; page++) {
+        u8* vram_page = &vram[vram_bank * 0x2000 + ((page - 0x80) << 8)];
+        MapReadPage(page, vram_blocked ? open_bus_page.data() : vram_page);
+        MapWritePage(page, vram_blocked ? discard_page.data() : nullptr);
+    }
+}
 
-                // LDEBUG("bus: reading 0x{:02X} to 0x{:04X} (OAM / Sprite Attribute Table)", oam[0xFE00], addr);
-                return oam[addr - 0xFE00];
+void Bus::RemapWRAM() {
+    // The switchable bank, and its echo up to where OAM starts.
+    for (u16 page = 0xD0; page < 0xE0; page++) {
+        u8* wram_page = &wram[wram_bank * 0x1000 + ((page - 0xD0) << 8)];
+        MapReadPage(page, wram_page);
+        MapWritePage(page, wram_page);
+        if (page + 0x20 < 0xFE) {
+            MapReadPage(page + 0x20, wram_page);
+            MapWritePage(page + 0x20, wram_page);
+        }
+    }
+}
 
-            case 0xFEA0 ... 0xFEFF:
-                // LWARN("bus: attempted to read from unusable memory (0x{:04X})", addr);
-                return 0x00;
+void Bus::RemapOAM() {
+    // Reading 0xFEA0-0xFEFF while OAM is blocked also returns 0xFF, so the whole page can be swapped.
+    const bool blocked = oam_blocked || oam_dma.active;
+    MapReadPage(0xFE, blocked ? open_bus_page.data() : nullptr);
+    MapWritePage(0xFE, blocked ? discard_page.data() : nullptr);
+}
 
-            case 0xFF00 ... 0xFF7F:
-                return ReadIO(addr & 0xFF);
+void Bus::SetPPUMemoryAccess(bool vram_accessible, bool oam_accessible) {
+    if (vram_blocked == vram_accessible) {
+        vram_blocked = !vram_accessible;
+        RemapVRAM();
+    }
 
-            case 0xFF80 ... 0xFFFE:
-                // LDEBUG("bus: reading 0x{:02X} from 0x{:04X} (Zero Page)", hram[addr - 0xFF80], addr);
-                return hram[addr - 0xFF80];
+    if (oam_blocked == oam_accessible) {
+        oam_blocked = !oam_accessible;
+        RemapOAM();
+    }
+}
 
-            case 0xFFFF:
-                // Interrupt enable
-                return ie;
+u8 Bus::Read8(u16 addr, bool affect_timer) {
+    u8 value;
+    if (const u8* page = read_pages[addr >> 8]) {
+        value = page[addr & 0xFF];
+    } else if (has_watchpoints) [[unlikely]] {
+        value = ReadWatched(addr, affect_timer);
+    } else {
+        value = ReadSlowPath(addr);
+    }
 
-            default:
-                UNREACHABLE();
-        }
-    }();
+#ifdef HELIAGE_MEMORY_PROFILING
+    memory_profiler.RecordRead(addr, affect_timer);
+#endif
 
     if (affect_timer) {
         timer.AdvanceCycles(4);
@@ -103,6 +156,224 @@ u8 Bus::Read8(u16 addr, bool affect_timer) {
 }
 
 void Bus::Write8(u16 addr, u8 value, bool affect_timer) {
+    if (u8* page = write_pages[addr >> 8]) {
+        page[addr & 0xFF] = value;
+    } else if (has_watchpoints) [[unlikely]] {
+        WriteWatched(addr, value, affect_timer);
+    } else {
+        WriteSlowPath(addr, value);
+    }
+
+#ifdef HELIAGE_MEMORY_PROFILING
+    memory_profiler.RecordWrite(addr, affect_timer);
+#endif
+
+    if (affect_timer) {
+        timer.AdvanceCycles(4);
+    }
+}
+
+// Only used while there are watchpoints, so the slow path doesn't pay for them otherwise.
+// Accesses that don't affect timing come from the hardware itself, not the CPU, so they
+// never trigger watchpoints.
+u8 Bus::ReadWatched(u16 addr, bool affect_timer) {
+    const u8* page = mapped_read_pages[addr >> 8];
+    const u8 value = page ? page[addr & 0xFF] : ReadSlowPath(addr);
+    if (affect_timer && watched_read_pages[addr >> 8]) {
+        CheckWatchpoints(addr, value, false);
+    }
+    return value;
+}
+
+void Bus::WriteWatched(u16 addr, u8 value, bool affect_timer) {
+    if (affect_timer && watched_write_pages[addr >> 8]) {
+        CheckWatchpoints(addr, value, true);
+    }
+
+    if (u8* page = mapped_write_pages[addr >> 8]) {
+        page[addr & 0xFF] = value;
+    } else {
+        WriteSlowPath(addr, value);
+    }
+}
+
+void Bus::CheckWatchpoints(u16 addr, u8 value, bool write) {
+    for (const Watchpoint& watchpoint : watchpoints) {
+        if (watchpoint.addr != addr || !(write ? watchpoint.on_write : watchpoint.on_read)) {
+            continue;
+        }
+
+        if (watchpoint.value.has_value() && *watchpoint.value != value) {
+            continue;
+        }
+
+        {
+            std::lock_guard lock(watchpoint_hits_mutex);
+            watchpoint_hits[watchpoint_hit_count % WATCHPOINT_HIT_LOG_SIZE] = WatchpointHit {
+                .addr = addr,
+                .pc = sm83.GetPC(),
+                .cycle = timer.GetElapsedCycles(),
+                .value = value,
+                .write = write,
+            };
+            watchpoint_hit_count++;
+        }
+
+        if (watchpoint.break_on_hit) {
+            watchpoint_break.store(true, std::memory_order_relaxed);
+        }
+    }
+}
+
+void Bus::AddWatchpoint(const Watchpoint& watchpoint) {
+    watchpoints.push_back(watchpoint);
+    UpdateWatchedPages();
+}
+
+void Bus::RemoveWatchpoint(u16 addr) {
+    std::erase_if(watchpoints, [addr](const Watchpoint& watchpoint) { return watchpoint.addr == addr; });
+    UpdateWatchedPages();
+}
+
+void Bus::ClearWatchpoints() {
+    watchpoints.clear();
+    UpdateWatchedPages();
+}
+
+void Bus::UpdateWatchedPages() {
+    watched_read_pages.reset();
+    watched_write_pages.reset();
+    for (const Watchpoint& watchpoint : watchpoints) {
+        if (watchpoint.on_read) {
+            watched_read_pages.set(watchpoint.addr >> 8);
+        }
+        if (watchpoint.on_write) {
+            watched_write_pages.set(watchpoint.addr >> 8);
+        }
+    }
+
+    has_watchpoints = watched_read_pages.any() || watched_write_pages.any();
+
+    for (u16 page = 0x00; page < 0x100; page++) {
+        read_pages[page] = watched_read_pages[page] ? nullptr : mapped_read_pages[page];
+        write_pages[page] = watched_write_pages[page] ? nullptr : mapped_write_pages[page];
+    }
+}
+
+bool Bus::AddCheat(std::string_view code) {
+    if (!cheats.Add(code)) {
+        return false;
+    }
+
+    RebuildROMPages();
+    RemapROM();
+    return true;
+}
+
+void Bus::RemoveCheat(std::string_view code) {
+    cheats.Remove(code);
+    RebuildROMPages();
+    RemapROM();
+}
+
+void Bus::ClearCheats() {
+    cheats.Clear();
+    RebuildROMPages();
+    RemapROM();
+}
+
+void Bus::ApplyRAMCheats() {
+    for (const Cheats::RAMWrite& write : cheats.GetRAMWrites()) {
+        Write8(write.addr, write.value, false);
+    }
+}
+
+std::vector<Bus::WatchpointHit> Bus::GetWatchpointHits() {
+    std::lock_guard lock(watchpoint_hits_mutex);
+
+    std::vector<WatchpointHit> hits;
+    const u64 count = std::min<u64>(watchpoint_hit_count, WATCHPOINT_HIT_LOG_SIZE);
+    hits.reserve(count);
+    for (u64 i = watchpoint_hit_count - count; i < watchpoint_hit_count; i++) {
+        hits.push_back(watchpoint_hits[i % WATCHPOINT_HIT_LOG_SIZE]);
+    }
+
+    return hits;
+}
+
+u8 Bus::Peek8(u16 addr) {
+    // The page table maps VRAM and OAM to the open bus page while they're blocked,
+    // but the slow path always reads them directly.
+    const bool ppu_memory = (addr >= 0x8000 && addr < 0xA000) || (addr >= 0xFE00 && addr < 0xFEA0);
+    if (!ppu_memory) {
+        if (const u8* page = mapped_read_pages[addr >> 8]) {
+            return page[addr & 0xFF];
+        }
+    }
+
+    return ReadSlowPath(addr);
+}
+
+u8 Bus::ReadSlowPath(u16 addr) {
+    switch (addr) {
+        case 0x0000 ... 0x7FFF:
+        {
+            if (boot_rom_enabled && bootrom.IsMapped(addr)) {
+                return bootrom.Read(addr);
+            }
+
+            // ROM is normally read through the page table, but go through the same pages here
+            // so that Game Genie patches still apply.
+            const u32 offset = (addr >= 0x4000) ? (addr & 0x3FFF) + GetROMBank() * 0x4000 : addr;
+            return rom_pages[offset >> 8][offset & 0xFF];
+        }
+
+        case 0x8000 ... 0x9FFF:
+            // LDEBUG("bus: reading 0x{:02X} from 0x{:04X} (VRAM)", vram[addr - 0x8000], addr);
+            return vram[vram_bank * 0x2000 + (addr - 0x8000)];
+
+        case 0xA000 ... 0xBFFF:
+            if (!mbc_ram_enabled || mbc3_rtc_selected) {
+                // LWARN("bus: attempted to read from cartridge RAM while it is disabled (from 0x{:04X})", addr);
+                return 0xFF;
+            }
+
+            // LDEBUG("bus: reading 0x{:02X} from 0x{:04X} (Cartridge RAM)", cartridge_ram.Read(GetCartridgeRAMOffset(addr)), addr);
+            return cartridge_ram.Read(GetCartridgeRAMOffset(addr));
+
+        case 0xC000 ... 0xDFFF:
+            // LDEBUG("bus: reading 0x{:02X} from 0x{:04X} (WRAM)", wram[GetWRAMOffset(addr)], addr);
+            return wram[GetWRAMOffset(addr)];
+
+        case 0xE000 ... 0xFDFF:
+            // LWARN("bus: reading from echo RAM (0x{:02X} from 0x{:04X})", wram[GetWRAMOffset(addr)], addr);
+            return wram[GetWRAMOffset(addr)];
+
+        case 0xFE00 ... 0xFE9F:
+            // LDEBUG("bus: reading 0x{:02X} to 0x{:04X} (OAM / Sprite Attribute Table)", oam[0xFE00], addr);
+            return oam[addr - 0xFE00];
+
+        case 0xFEA0 ... 0xFEFF:
+            // LWARN("bus: attempted to read from unusable memory (0x{:04X})", addr);
+            return 0x00;
+
+        case 0xFF00 ... 0xFF7F:
+            return ReadIO(addr & 0xFF);
+
+        case 0xFF80 ... 0xFFFE:
+            // LDEBUG("bus: reading 0x{:02X} from 0x{:04X} (Zero Page)", hram[addr - 0xFF80], addr);
+            return hram[addr - 0xFF80];
+
+        case 0xFFFF:
+            // Interrupt enable
+            return ie;
+
+        default:
+            UNREACHABLE();
+    }
+}
+
+void Bus::WriteSlowPath(u16 addr, u8 value) {
     switch (addr) {
         case 0x0000 ... 0x7FFF:
         {
@@ -112,42 +383,41 @@ void Bus::Write8(u16 addr, u8 value, bool affect_timer) {
             }
 
             WriteMBC(mbc_type, addr, value);
+            if (addr >= 0x2000) {
+                RemapROM();
+            }
             break;
         }
 
         case 0x8000 ... 0x9FFF:
-            vram[addr - 0x8000] = value;
-            ppu.UpdateTile(addr);
+            ppu.FinishPendingLines();
+            vram[vram_bank * 0x2000 + (addr - 0x8000)] = value;
+            ppu.MarkTileDirty(addr, vram_bank);
             break;
 
         case 0xA000 ... 0xBFFF:
-            if (!mbc_ram_enabled) {
+            if (!mbc_ram_enabled || mbc3_rtc_selected) {
                 // LWARN("bus: attempted to write to cartridge RAM while it is disabled (0x{:02X} to 0x{:04X})", value, addr);
                 break;
             }
 
-            LDEBUG("bus: writing 0x{:02X} to 0x{:04X} (Cartridge RAM)", value, addr);
-            cartridge_ram[addr - 0xA000] = value;
+            // LDEBUG("bus: writing 0x{:02X} to 0x{:04X} (Cartridge RAM)", value, addr);
+            cartridge_ram.Write(GetCartridgeRAMOffset(addr), value);
             break;
 
         case 0xC000 ... 0xDFFF:
             // LDEBUG("bus: writing 0x{:02X} to 0x{:04X} (WRAM)", value, addr);
-            wram[addr - 0xC000] = value;
+            wram[GetWRAMOffset(addr)] = value;
             break;
 
         case 0xE000 ... 0xFDFF:
             // LWARN("bus: writing to echo RAM (0x{:02X} to 0x{:04X})", value, addr);
-            wram[addr - 0xE000] = value;
+            wram[GetWRAMOffset(addr)] = value;
             break;
 
         case 0xFE00 ... 0xFE9F:
-            if (oam_dma.active) {
-                return;
-            }
-
             // LDEBUG("bus: writing 0x{:02X} to 0x{:04X} (OAM / Sprite Attribute Table)", value, addr);
             oam[addr - 0xFE00] = value;
-            ppu.UpdateSprite(addr);
             break;
 
         case 0xFEA0 ... 0xFEFF:
@@ -171,10 +441,6 @@ void Bus::Write8(u16 addr, u8 value, bool affect_timer) {
         default:
             UNREACHABLE();
     }
-
-    if (affect_timer) {
-        timer.AdvanceCycles(4);
-    }
 }
 
 void Bus::WriteMBC(u8 mbc_type, u16 addr, u8 value) {
@@ -188,9 +454,17 @@ void Bus::WriteMBC(u8 mbc_type, u16 addr, u8 value) {
             switch (addr & 0xF000) {
                 case 0x0000:
                 case 0x1000:
+                {
+                    const bool was_enabled = mbc_ram_enabled;
                     mbc_ram_enabled = ((value & 0xF) == 0xA);
                     LDEBUG("MBC1: RAM {}", mbc_ram_enabled ? "enabled" : "disabled");
+
+                    // Games disable RAM once they're done saving, which is a good time to write it back.
+                    if (was_enabled && !mbc_ram_enabled) {
+                        cartridge_ram.RequestFlush();
+                    }
                     break;
+                }
                 case 0x2000:
                 case 0x3000:
                     if (value == 0x00 || value == 0x20 || value == 0x40 || value == 0x60) {
@@ -223,14 +497,19 @@ void Bus::WriteMBC(u8 mbc_type, u16 addr, u8 value) {
                     break;
             }
             return;
-        case 0x10:
-        case 0x11:
-        case 0x13:
+        case 0x0F ... 0x13:
             switch (addr & 0xF000) {
                 case 0x0000:
                 case 0x1000:
+                {
+                    const bool was_enabled = mbc_ram_enabled;
                     mbc_ram_enabled = ((value & 0xF) == 0xA);
+
+                    if (was_enabled && !mbc_ram_enabled) {
+                        cartridge_ram.RequestFlush();
+                    }
                     break;
+                }
                 case 0x2000:
                 case 0x3000:
                     if (value == 0x00) {
@@ -239,6 +518,18 @@ void Bus::WriteMBC(u8 mbc_type, u16 addr, u8 value) {
                         mbc3_rom_bank = value & 0x7F;
                     }
 
+                    break;
+                case 0x4000:
+                case 0x5000:
+                    if (value <= 0x03) {
+                        mbc3_ram_bank = value;
+                        mbc3_rtc_selected = false;
+                    } else if (value >= 0x08 && value <= 0x0C) {
+                        // The RTC isn't emulated, so its registers read as open bus and ignore writes.
+                        LWARN("MBC3: selected RTC register 0x{:02X}, which is not implemented", value);
+                        mbc3_rtc_selected = true;
+                    }
+
                     break;
                 default:
                     LERROR("MBC3: unimplemented write (0x{:02X} to 0x{:04X})", value, addr);
@@ -415,18 +706,52 @@ u8 Bus::ReadIO(u8 addr) {
             return wx;
         }
 
-        // These are CGB registers.
-        case 0x4D:
+        // The rest are CGB registers, which read as 0xFF in DMG mode.
+        case 0x4F:
+            // VRAM bank. Bits 7-1 are unused.
+            return IsCGBMode() ? (0xFE | vram_bank) : 0xFF;
         case 0x56:
+            // Infrared. Bit 1 reads as set when no light is being received, which is always.
+            return IsCGBMode() ? ((io[0x56] & 0xC1) | 0x3E) : 0xFF;
+        case 0x68:
+            return IsCGBMode() ? ppu.GetBCPS() : 0xFF;
+        case 0x69:
+            return IsCGBMode() ? ppu.GetBCPD() : 0xFF;
+        case 0x6A:
+            return IsCGBMode() ? ppu.GetOCPS() : 0xFF;
+        case 0x6B:
+            return IsCGBMode() ? ppu.GetOCPD() : 0xFF;
         case 0x6C:
+            // Object priority mode. Bits 7-1 are unused.
+            return IsCGBMode() ? (0xFE | ppu.GetOPRI()) : 0xFF;
         case 0x70:
+            // WRAM bank. Bits 7-3 are unused. Reads give back what was written, even 0.
+            return IsCGBMode() ? (0xF8 | io[0x70]) : 0xFF;
         case 0x72:
         case 0x73:
+            // Undocumented, but readable and writable on every CGB.
+            return bootrom.IsCGB() ? io[addr] : 0xFF;
         case 0x74:
+            return IsCGBMode() ? io[0x74] : 0xFF;
         case 0x75:
+            // Only bits 6-4 are readable and writable.
+            return bootrom.IsCGB() ? (io[0x75] | 0x8F) : 0xFF;
         case 0x76:
         case 0x77:
-            return 0xFF;
+            // The audio channels' digital outputs, which are silent without an APU.
+            return bootrom.IsCGB() ? 0x00 : 0xFF;
+
+        case 0x4D:
+            // KEY1: bit 7 is the current speed, bit 0 whether the next STOP switches it.
+            return IsCGBMode() ? (timer.IsDoubleSpeed() << 7 | 0x7E | speed_switch_armed) : 0xFF;
+        case 0x55:
+            // HDMA5: bit 7 is clear while an HBlank DMA is running, and the rest is the blocks left
+            // minus one. That makes it 0xFF once a transfer has finished.
+            if (!IsCGBMode()) {
+                return 0xFF;
+            }
+
+            return (vram_dma.hblank_active ? 0x00 : 0x80) | ((vram_dma.blocks_left - 1) & 0x7F);
 
         // These are unused registers.
         case 0x03:
@@ -434,12 +759,13 @@ u8 Bus::ReadIO(u8 addr) {
         case 0x15:
         case 0x1F:
         case 0x27 ... 0x29:
+        // KEY0 is write-only, and only while the boot ROM is mapped.
         case 0x4C:
-        case 0x4E ... 0x4F:
-        // 0xFF50 is write-only
+        case 0x4E:
+        // 0xFF50 is write-only, and so are HDMA1-4
         case 0x50:
-        case 0x51 ... 0x55:
-        case 0x57 ... 0x6B:
+        case 0x51 ... 0x54:
+        case 0x57 ... 0x67:
         case 0x6D ... 0x6F:
         case 0x71:
         case 0x78 ... 0x7F:
@@ -559,12 +885,89 @@ void Bus::WriteIO(u8 addr, u8 value) {
             ppu.SetWX(value);
             io[0x4B] = value;
             return;
+        case 0x4C:
+            // KEY0. The CGB boot ROM sets bit 2 when it finds a DMG cartridge.
+            if (boot_rom_enabled && bootrom.IsCGB()) {
+                io[0x4C] = value;
+            }
+            return;
+        case 0x4F:
+            if (IsCGBMode()) {
+                vram_bank = value & 0x1;
+                RemapVRAM();
+            }
+            return;
         case 0x50:
             if (boot_rom_enabled && value & 0b1) {
                 LINFO("bus: disabling bootrom");
                 boot_rom_enabled = false;
+                RemapROM();
+
+                // KEY0 takes effect when the boot ROM is done. Without CGB mode, the banks are stuck at their defaults.
+                if (bootrom.IsCGB() && (io[0x4C] & 0x04)) {
+                    ppu.SetHardwareMode(PPU::HardwareMode::DMGCompatibility);
+                    vram_bank = 0;
+                    wram_bank = 1;
+                    RemapVRAM();
+                    RemapWRAM();
+                }
             }
 
+            return;
+        case 0x4D:
+            if (IsCGBMode()) {
+                speed_switch_armed = value & 0x1;
+            }
+            return;
+        case 0x51:
+            vram_dma.source = (vram_dma.source & 0x00FF) | value << 8;
+            return;
+        case 0x52:
+            vram_dma.source = (vram_dma.source & 0xFF00) | (value & 0xF0);
+            return;
+        case 0x53:
+            vram_dma.destination = (vram_dma.destination & 0x00FF) | (value & 0x1F) << 8;
+            return;
+        case 0x54:
+            vram_dma.destination = (vram_dma.destination & 0xFF00) | (value & 0xF0);
+            return;
+        case 0x55:
+            if (IsCGBMode()) {
+                StartVRAMDMA(value);
+            }
+            return;
+        case 0x68:
+            if (IsCGBMode()) {
+                ppu.SetBCPS(value);
+            }
+            return;
+        case 0x69:
+            if (IsCGBMode()) {
+                ppu.SetBCPD(value);
+            }
+            return;
+        case 0x6A:
+            if (IsCGBMode()) {
+                ppu.SetOCPS(value);
+            }
+            return;
+        case 0x6B:
+            if (IsCGBMode()) {
+                ppu.SetOCPD(value);
+            }
+            return;
+        case 0x6C:
+            if (IsCGBMode()) {
+                ppu.SetOPRI(value);
+            }
+            return;
+        case 0x70:
+            if (IsCGBMode()) {
+                // Bank 0 is always at 0xC000, so selecting it gives bank 1.
+                io[0x70] = value & 0x7;
+                wram_bank = std::max<u8>(io[0x70], 1);
+                RemapWRAM();
+            }
             return;
         default:
             LDEBUG("bus: writing 0x{:02X} to 0xFF{:02X} (unknown IO)", value, addr);
@@ -579,7 +982,7 @@ void Bus::DumpMemoryToFile() {
     for (u32 i = 0x0000; i < 0x10000; i += 0x10) {
         file.print("{:04X} ", i);
         for (u16 j = 0x0; j < 0x10; j++) {
-            u8 byte = Read8(static_cast<u16>(i + j), false);
+            u8 byte = Peek8(static_cast<u16>(i + j));
             file.print(" {:02X}", byte);
         }
         file.print("\n");
@@ -588,15 +991,142 @@ void Bus::DumpMemoryToFile() {
     file.close();
 }
 
+#ifdef HELIAGE_MEMORY_PROFILING
+void Bus::DumpMemoryProfile() {
+    memory_profiler.ExportCSV("memory_profile.csv");
+    memory_profiler.ExportJSON("memory_profile.json");
+}
+#endif
+
 Joypad* Bus::GetJoypad() {
     return &joypad;
 }
 
+CartridgeRAM* Bus::GetCartridgeRAM() {
+    return &cartridge_ram;
+}
+
+#define CART_IS_MBC1() (mbc_type >= 0x01 && mbc_type <= 0x03)
+#define CART_IS_MBC3() (mbc_type >= 0x0F && mbc_type <= 0x13)
+
+u16 Bus::GetROMBank() const {
+    u8 mbc_type = cartridge.GetMBCType();
+    u16 rom_bank = 0x001;
+    if (CART_IS_MBC1()) {
+        rom_bank = ((mbc1_bank2 & 3) << 5) | (mbc1_bank1 & 0x1F);
+    } else if (CART_IS_MBC3()) {
+        rom_bank = mbc3_rom_bank;
+    }
+
+    return rom_bank % cartridge.GetROMBankCount();
+}
+
+u32 Bus::GetWRAMOffset(u16 addr) const {
+    // Echo RAM mirrors 0xC000-0xDDFF.
+    const u16 offset = (addr - 0xC000) & 0x1FFF;
+    return (offset < 0x1000) ? offset : wram_bank * 0x1000 + (offset - 0x1000);
+}
+
+u32 Bus::GetCartridgeRAMOffset(u16 addr) const {
+    u8 mbc_type = cartridge.GetMBCType();
+    u8 ram_bank = 0;
+    if (CART_IS_MBC1()) {
+        ram_bank = (mbc1_mode == 1) ? mbc1_ram_bank : 0;
+    } else if (CART_IS_MBC3()) {
+        ram_bank = mbc3_ram_bank;
+    }
+
+    return ram_bank * 0x2000 + (addr - 0xA000);
+}
+
 void Bus::StartOAMDMATransfer(const u8 source_address) {
     oam_dma.source_address = source_address;
     oam_dma.active = true;
     // There is a 1 M-cycle delay when starting OAM DMA.
     oam_dma.start_delay = true;
+    RemapOAM();
+}
+
+void Bus::StartVRAMDMA(u8 value) {
+    // Bit 7 clear stops a running HBlank DMA instead of starting a general purpose one.
+    if (vram_dma.hblank_active && !(value & 0x80)) {
+        vram_dma.hblank_active = false;
+        return;
+    }
+
+    vram_dma.blocks_left = (value & 0x7F) + 1;
+    if (!(value & 0x80)) {
+        CopyVRAMDMABlocks(vram_dma.blocks_left);
+        return;
+    }
+
+    // Starting an HBlank DMA during HBlank copies the first block straight away.
+    vram_dma.hblank_active = true;
+    if (ppu.IsLCDEnabled() && (ppu.GetSTAT() & 0x3) == 0) {
+        CopyHBlankDMABlock();
+    }
+}
+
+void Bus::CopyHBlankDMABlock() {
+    CopyVRAMDMABlocks(1);
+    if (vram_dma.blocks_left == 0) {
+        vram_dma.hblank_active = false;
+    }
+}
+
+void Bus::CopyVRAMDMABlocks(u8 blocks) {
+    PROFILE_ACCESS_SOURCE(memory_profiler, DMA);
+    ppu.FinishPendingLines();
+
+    // Copy as much as possible at once: everything up to the end of the source page, or of VRAM,
+    // where the destination wraps around. Blocks are 16-byte aligned, so they never straddle either.
+    u8* bank = &vram[vram_bank * 0x2000];
+    u32 length = blocks * 16;
+    while (length != 0) {
+        const u32 run = std::min({ length, 0x100u - (vram_dma.source & 0xFF), 0x2000u - vram_dma.destination });
+        if (const u8* page = mapped_read_pages[vram_dma.source >> 8]) {
+            // The source can be VRAM itself.
+            std::memmove(bank + vram_dma.destination, page + (vram_dma.source & 0xFF), run);
+        } else {
+            for (u32 i = 0; i < run; i++) {
+                bank[vram_dma.destination + i] = ReadSlowPath(vram_dma.source + i);
+            }
+        }
+
+        for (u32 offset = 0; offset < run; offset += 16) {
+            ppu.MarkTileDirty(0x8000 + vram_dma.destination + offset, vram_bank);
+        }
+#ifdef HELIAGE_MEMORY_PROFILING
+        for (u32 i = 0; i < run; i++) {
+            memory_profiler.RecordRead(vram_dma.source + i, MemoryProfiler::Source::DMA);
+            memory_profiler.RecordWrite(0x8000 + vram_dma.destination + i, MemoryProfiler::Source::DMA);
+        }
+#endif
+
+        vram_dma.source += run;
+        vram_dma.destination = (vram_dma.destination + run) & 0x1FFF;
+        length -= run;
+    }
+
+    vram_dma.blocks_left -= blocks;
+
+    // A block takes 32 dots, which is twice as many CPU cycles at double speed.
+    cpu_stall_cycles += blocks * (timer.IsDoubleSpeed() ? 64 : 32);
+}
+
+bool Bus::SwitchSpeed() {
+    if (!IsCGBMode() || !speed_switch_armed) {
+        return false;
+    }
+
+    speed_switch_armed = false;
+    timer.SetDoubleSpeed(!timer.IsDoubleSpeed());
+    LDEBUG("bus: switched to {} speed", timer.IsDoubleSpeed() ? "double" : "normal");
+
+    // DIV is reset, and the CPU stays stopped for 2050 M-cycles while the clock settles.
+    timer.ResetDivider();
+    cpu_stall_cycles += 2050 * 4;
+    return true;
 }
 
 void Bus::RunOAMDMATransferCycle() {
@@ -605,12 +1135,18 @@ void Bus::RunOAMDMATransferCycle() {
         return;
     }
 
+    PROFILE_ACCESS_SOURCE(memory_profiler, DMA);
+
     const u16 source_address = oam_dma.source_address << 8 | oam_dma.byte_index;
     oam[oam_dma.byte_index] = Read8(source_address, false);
+#ifdef HELIAGE_MEMORY_PROFILING
+    memory_profiler.RecordWrite(0xFE00 | oam_dma.byte_index, MemoryProfiler::Source::DMA);
+#endif
 
     oam_dma.byte_index++;
     if (oam_dma.byte_index >= 160) {
         oam_dma.active = false;
         oam_dma.byte_index = 0;
+        RemapOAM();
     }
 }
@@ -1,19 +1,54 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <bitset>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
 #include "bootrom.h"
 #include "cartridge.h"
+#include "cartridge_ram.h"
+#include "cheats.h"
 #include "common/types.h"
 #include "joypad.h"
+#include "memory_profiler.h"
 #include "ppu.h"
 #include "timer.h"
 
+class SM83;
+
 class Bus {
 public:
-    Bus(BootROM& bootrom, Cartridge& cartridge, Joypad& joypad, PPU& ppu, Timer& timer);
+    struct Watchpoint {
+        u16 addr = 0x0000;
+        bool on_read = false;
+        bool on_write = false;
+        // If set, only accesses of this value count as a hit.
+        std::optional<u8> value {};
+        bool break_on_hit = false;
+    };
+
+    struct WatchpointHit {
+        u16 addr = 0x0000;
+        u16 pc = 0x0000;
+        u64 cycle = 0;
+        u8 value = 0x00;
+        bool write = false;
+    };
+
+    Bus(BootROM& bootrom, Cartridge& cartridge, Joypad& joypad, PPU& ppu, SM83& sm83, Timer& timer);
 
     u8 Read8(u16 addr, bool affect_timer = true);
     void Write8(u16 addr, u8 value, bool affect_timer = true);
+
+    // Reads memory without any side effects on the emulated system: no timing,
+    // watchpoints or profiling, and VRAM/OAM can be read even while the PPU has them blocked.
+    u8 Peek8(u16 addr);
     void WriteMBC(u8 mbc_type, u16 addr, u8 value);
 
     u8 ReadIO(u8 addr);
@@ -21,20 +56,134 @@ public:
 
     void DumpMemoryToFile();
 
+#ifdef HELIAGE_MEMORY_PROFILING
+    MemoryProfiler& GetMemoryProfiler() { return memory_profiler; }
+    void DumpMemoryProfile();
+#endif
+
     Joypad* GetJoypad();
+    CartridgeRAM* GetCartridgeRAM();
+
+    // The system is a CGB if the boot ROM is a CGB one.
+    bool IsCGB() const { return bootrom.IsCGB(); }
+
+    // The PPU reads these directly instead of going through the bus. VRAM has both banks, bank 1 at 0x2000.
+    std::span<const u8, 0x4000> GetVRAM() const { return vram; }
+    std::span<const u8, 0xA0> GetOAM() const { return oam; }
 
     bool IsOAMDMAActive() const { return oam_dma.active; }
     void RunOAMDMATransferCycle();
 
+    // Called by the PPU on mode transitions.
+    void SetPPUMemoryAccess(bool vram_accessible, bool oam_accessible);
+
+    // CGB VRAM DMA copies its 16-byte blocks in one go: all of them when a general purpose DMA
+    // starts, or one at the start of every HBlank for an HBlank DMA. The CPU then makes up for
+    // the time the copy takes on hardware by sitting out the stall cycles.
+    // Called by the PPU as HBlank starts.
+    void RunHBlankDMA() {
+        if (vram_dma.hblank_active) {
+            CopyHBlankDMABlock();
+        }
+    }
+    // Called by the CPU before every instruction.
+    u64 TakeCPUStallCycles() { return std::exchange(cpu_stall_cycles, 0); }
+
+    // Switches between normal and double speed if KEY1 asked for it. Called by the CPU on STOP.
+    bool SwitchSpeed();
+
+    // Watchpoints only trigger on CPU accesses. These must not be called
+    // while the emulation thread is running.
+    void AddWatchpoint(const Watchpoint& watchpoint);
+    void RemoveWatchpoint(u16 addr);
+    void ClearWatchpoints();
+    const std::vector<Watchpoint>& GetWatchpoints() const { return watchpoints; }
+
+    // Like watchpoints, cheats must not be changed while the emulation thread is running.
+    bool AddCheat(std::string_view code);
+    void RemoveCheat(std::string_view code);
+    void ClearCheats();
+    // Applies GameShark codes. Called by the PPU once per frame, at the start of VBlank.
+    void ApplyRAMCheats();
+
+    // Returns the most recent hits, oldest first.
+    std::vector<WatchpointHit> GetWatchpointHits();
+    bool IsWatchpointBreakPending() const { return watchpoint_break.load(std::memory_order_relaxed); }
+    void ClearWatchpointBreak() { watchpoint_break.store(false, std::memory_order_relaxed); }
+
 private:
     void LoadInitialValues();
 
+    u8 ReadSlowPath(u16 addr);
+    void WriteSlowPath(u16 addr, u8 value);
+
+    void MapReadPage(u8 page, const u8* memory);
+    void MapWritePage(u8 page, u8* memory);
+    void MapFixedPages();
+    void RebuildROMPages();
+    void RemapROM();
+    void RemapVRAM();
+    void RemapWRAM();
+    void RemapOAM();
+
+    // Each 256-byte page of the address space either points straight at backing
+    // memory, or is nullptr if accesses need side effects and have to go through
+    // the slow path. Blocking access to a region is done by swapping in the
+    // open bus/discard pages rather than checking on every access.
+    // read_pages/write_pages are what Read8/Write8 use; they're the same as the
+    // mapped_* tables except that pages with watchpoints are forced to nullptr.
+    std::array<const u8*, 0x100> read_pages {};
+    std::array<u8*, 0x100> write_pages {};
+    std::array<const u8*, 0x100> mapped_read_pages {};
+    std::array<u8*, 0x100> mapped_write_pages {};
+    std::array<u8, 0x100> open_bus_page;
+    std::array<u8, 0x100> discard_page;
+
+    bool vram_blocked = false;
+    bool oam_blocked = false;
+
+    // Every 256-byte page of the ROM. These point into the cartridge's ROM, or into
+    // a patched copy of the page if a Game Genie code touches it.
+    std::vector<const u8*> rom_pages;
+    std::map<u32, std::array<u8, 0x100>> rom_overlay;
+    Cheats cheats;
+
+    u8 ReadWatched(u16 addr, bool affect_timer);
+    void WriteWatched(u16 addr, u8 value, bool affect_timer);
+    void CheckWatchpoints(u16 addr, u8 value, bool write);
+    void UpdateWatchedPages();
+
+    std::vector<Watchpoint> watchpoints;
+    std::bitset<0x100> watched_read_pages;
+    std::bitset<0x100> watched_write_pages;
+    bool has_watchpoints = false;
+
+    static constexpr size_t WATCHPOINT_HIT_LOG_SIZE = 256;
+    std::array<WatchpointHit, WATCHPOINT_HIT_LOG_SIZE> watchpoint_hits {};
+    u64 watchpoint_hit_count = 0;
+    std::mutex watchpoint_hits_mutex;
+    std::atomic<bool> watchpoint_break = false;
+
+#ifdef HELIAGE_MEMORY_PROFILING
+    MemoryProfiler memory_profiler;
+#endif
+    u32 GetCartridgeRAMOffset(u16 addr) const;
+    u16 GetROMBank() const;
+    u32 GetWRAMOffset(u16 addr) const;
+
+    // Whether the CGB registers and VRAM/WRAM banking are there. A CGB running a DMG cartridge
+    // doesn't have them once the boot ROM is done.
+    bool IsCGBMode() const { return ppu.GetHardwareMode() == PPU::HardwareMode::CGB; }
+
     bool boot_rom_enabled = true;
 
-    std::array<u8, 0x2000> vram;
-    // TODO: make this a std::vector
-    std::array<u8, 0x2000> cartridge_ram;
-    std::array<u8, 0x2000> wram;
+    // Two banks on a CGB, picked by VBK.
+    std::array<u8, 0x4000> vram;
+    u8 vram_bank = 0;
+    CartridgeRAM cartridge_ram;
+    // Eight 4KB banks on a CGB. Bank 0 is always at 0xC000, and SVBK picks the one at 0xD000.
+    std::array<u8, 0x8000> wram;
+    u8 wram_bank = 1;
     std::array<u8, 0xA0> oam;
     std::array<u8, 0x80> io;
     std::array<u8, 0x7F> hram;
@@ -47,6 +196,8 @@ private:
     u8 mbc1_ram_bank = 0;
 
     u8 mbc3_rom_bank = 0x01;
+    u8 mbc3_ram_bank = 0;
+    bool mbc3_rtc_selected = false;
 
     struct {
         u8 source_address;
@@ -57,9 +208,26 @@ private:
 
     void StartOAMDMATransfer(u8 source_address);
 
+    struct {
+        u16 source;
+        // Offset into the current VRAM bank.
+        u16 destination;
+        u8 blocks_left;
+        bool hblank_active;
+    } vram_dma {};
+
+    // CPU cycles the CPU still has to sit out.
+    u64 cpu_stall_cycles = 0;
+    bool speed_switch_armed = false;
+
+    void StartVRAMDMA(u8 value);
+    void CopyHBlankDMABlock();
+    void CopyVRAMDMABlocks(u8 blocks);
+
     BootROM bootrom;
     Cartridge cartridge;
     Joypad& joypad;
     PPU& ppu;
+    SM83& sm83;
     Timer& timer;
 };
@@ -4,7 +4,8 @@
 #include "cartridge.h"
 #include "logging.h"
 
-Cartridge::Cartridge(std::filesystem::path& cartridge_path) {
+Cartridge::Cartridge(std::filesystem::path& cartridge_path)
+    : path(cartridge_path) {
     LoadCartridge(cartridge_path);
     // PrintMetadata();
 
@@ -33,8 +34,11 @@ void Cartridge::LoadCartridge(std::filesystem::path& cartridge_path) {
     std::ifstream stream(cartridge_path.string().c_str(), std::ios::binary);
     ASSERT_MSG(stream.is_open(), "could not open ROM: {}", cartridge_path.string().c_str());
 
-    rom.resize(rom_size);
-    stream.read(reinterpret_cast<char*>(rom.data()), rom.size());
+    // Pad the ROM out to a whole number of banks (and at least the two that are always mapped),
+    // so the bus can map any bank without checking bounds.
+    const u32 padded_size = std::max<u32>((rom_size + 0x3FFF) & ~0x3FFF, 0x8000);
+    rom.resize(padded_size, 0xFF);
+    stream.read(reinterpret_cast<char*>(rom.data()), rom_size);
 
     LINFO("cartridge: loaded {} bytes ({} KB)", rom_size, rom_size / 1024);
 }
@@ -145,6 +149,43 @@ const char* Cartridge::GetRAMSizeString() const {
     }
 }
 
+u32 Cartridge::GetRAMSize() const {
+    switch (rom.at(0x149)) {
+        case 0x01: return 2 * 1024;
+        case 0x02: return 8 * 1024;
+        case 0x03: return 32 * 1024;
+        case 0x04: return 128 * 1024;
+        case 0x05: return 64 * 1024;
+        default:
+            return 0;
+    }
+}
+
+bool Cartridge::HasBattery() const {
+    switch (GetMBCType()) {
+        case 0x03:
+        case 0x06:
+        case 0x09:
+        case 0x0D:
+        case 0x0F:
+        case 0x10:
+        case 0x13:
+        case 0x1B:
+        case 0x1E:
+        case 0x22:
+        case 0xFF:
+            return true;
+        default:
+            return false;
+    }
+}
+
+std::filesystem::path Cartridge::GetSavePath() const {
+    std::filesystem::path save_path = path;
+    save_path.replace_extension(".sav");
+    return save_path;
+}
+
 bool Cartridge::CheckNintendoLogo() const {
     const std::array<u8, 0x30> nintendo_logo = {
         0xCE, 0xED, 0x66, 0x66, 0xCC, 0x0D, 0x00, 0x0B,
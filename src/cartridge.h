@@ -1,6 +1,7 @@
 #pragma once
 
 #include <filesystem>
+#include <span>
 #include <vector>
 #include "common/types.h"
 
@@ -14,13 +15,24 @@ public:
     const char* GetMBCTypeString() const;
     const char* GetROMSizeString() const;
     const char* GetRAMSizeString() const;
+    u32 GetRAMSize() const;
+    bool HasBattery() const;
+    // The CGB flag at 0x143: 0x80 works on both, 0xC0 only on a CGB.
+    bool SupportsCGB() const { return rom.at(0x143) & 0x80; }
+    bool RequiresCGB() const { return rom.at(0x143) == 0xC0; }
+    std::filesystem::path GetSavePath() const;
     bool CheckNintendoLogo() const;
     u8 CalculateHeaderChecksum() const;
     u16 CalculateROMChecksum() const;
 
     u8 Read(u32 addr) const;
+
+    // Padded to a whole number of 16KB banks.
+    std::span<const u8> GetROM() const { return rom; }
+    u32 GetROMBankCount() const { return rom.size() / 0x4000; }
 private:
     void LoadCartridge(std::filesystem::path& cartridge_path);
+    std::filesystem::path path;
     std::vector<u8> rom;
     u32 rom_size = 0; // ROMs range from 32KB to 8MB
 };
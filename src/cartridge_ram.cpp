@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cartridge_ram.h"
+#include "logging.h"
+
+CartridgeRAM::CartridgeRAM(u32 size, bool battery, const std::filesystem::path& save_path)
+    : size(size), mask(size ? size - 1 : 0) {
+    ASSERT_MSG(size <= MAX_SIZE, "cartridge RAM is too big ({} bytes)", size);
+
+    if (size == 0) {
+        return;
+    }
+
+    if (battery && MapSaveFile(save_path)) {
+        flush_thread = std::thread(&CartridgeRAM::FlushThread, this);
+        return;
+    }
+
+    memory.resize(size, 0xFF);
+    data = memory.data();
+}
+
+CartridgeRAM::~CartridgeRAM() {
+    if (flush_thread.joinable()) {
+        {
+            std::lock_guard lock(flush_mutex);
+            stopping = true;
+        }
+        flush_cv.notify_one();
+        flush_thread.join();
+    }
+
+    if (backed_by_file) {
+        FlushDirtyPages();
+        munmap(data, size);
+        close(fd);
+    }
+}
+
+bool CartridgeRAM::MapSaveFile(const std::filesystem::path& save_path) {
+    fd = open(save_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        LERROR("cartridge RAM: could not open save file {}: {}", save_path.string(), std::strerror(errno));
+        return false;
+    }
+
+    struct stat st {};
+    fstat(fd, &st);
+    const bool fresh = (st.st_size == 0);
+
+    // Save files from other emulators may have extra data (like RTC state) appended,
+    // so only ever grow the file, never shrink it.
+    if (static_cast<u64>(st.st_size) < size && ftruncate(fd, size) != 0) {
+        LERROR("cartridge RAM: could not resize save file {}: {}", save_path.string(), std::strerror(errno));
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        LERROR("cartridge RAM: could not map save file {}: {}", save_path.string(), std::strerror(errno));
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    data = static_cast<u8*>(mapping);
+    backed_by_file = true;
+
+    if (fresh) {
+        std::fill_n(data, size, 0xFF);
+        for (u32 i = 0; i < size / PAGE_SIZE; i++) {
+            dirty_pages[i / 64] |= u64(1) << (i % 64);
+        }
+    }
+
+    LINFO("cartridge RAM: mapped {} bytes from {}", size, save_path.string());
+    return true;
+}
+
+void CartridgeRAM::RequestFlush() {
+    if (!backed_by_file) {
+        return;
+    }
+
+    {
+        std::lock_guard lock(flush_mutex);
+        flush_requested = true;
+    }
+    flush_cv.notify_one();
+}
+
+void CartridgeRAM::SetFlushInterval(std::chrono::milliseconds interval) {
+    {
+        std::lock_guard lock(flush_mutex);
+        flush_interval = interval;
+    }
+    flush_cv.notify_one();
+}
+
+void CartridgeRAM::FlushThread() {
+    std::unique_lock lock(flush_mutex);
+    while (!stopping) {
+        flush_cv.wait_for(lock, flush_interval, [this] { return stopping || flush_requested; });
+        flush_requested = false;
+
+        lock.unlock();
+        FlushDirtyPages();
+        lock.lock();
+    }
+}
+
+void CartridgeRAM::FlushDirtyPages() {
+    // The mapping is MAP_SHARED, so writes already live in the page cache and survive
+    // the process crashing. msync makes them survive the machine going down too.
+    const u32 os_page_size = static_cast<u32>(sysconf(_SC_PAGESIZE));
+    const u32 pages = size / PAGE_SIZE;
+
+    u32 range_start = 0;
+    u32 range_end = 0;
+    for (u32 word = 0; word * 64 < pages; word++) {
+        u64 bits = dirty_pages[word].exchange(0, std::memory_order_acquire);
+        while (bits) {
+            const u32 page = word * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+
+            const u32 start = (page * PAGE_SIZE) / os_page_size * os_page_size;
+            const u32 end = std::min(start + os_page_size, size);
+            if (range_end != 0 && start <= range_end) {
+                range_end = std::max(range_end, end);
+                continue;
+            }
+
+            if (range_end != 0) {
+                msync(data + range_start, range_end - range_start, MS_SYNC);
+            }
+            range_start = start;
+            range_end = end;
+        }
+    }
+
+    if (range_end != 0) {
+        msync(data + range_start, range_end - range_start, MS_SYNC);
+    }
+}
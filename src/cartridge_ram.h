@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "common/types.h"
+
+// External RAM on the cartridge (0xA000 - 0xBFFF, banked).
+// If the cartridge has a battery, the RAM is backed by an mmap'd .sav file,
+// and dirty 256-byte pages are written back by a background thread.
+class CartridgeRAM {
+public:
+    static constexpr u32 PAGE_SIZE = 0x100;
+    static constexpr u32 MAX_SIZE = 128 * 1024;
+    static constexpr std::chrono::milliseconds DEFAULT_FLUSH_INTERVAL { 1000 };
+
+    CartridgeRAM(u32 size, bool battery, const std::filesystem::path& save_path);
+    ~CartridgeRAM();
+
+    CartridgeRAM(const CartridgeRAM&) = delete;
+    CartridgeRAM& operator=(const CartridgeRAM&) = delete;
+
+    u8 Read(u32 offset) const {
+        if (size == 0) {
+            return 0xFF;
+        }
+
+        return data[offset & mask];
+    }
+
+    void Write(u32 offset, u8 value) {
+        if (size == 0) {
+            return;
+        }
+
+        offset &= mask;
+        data[offset] = value;
+
+        if (!backed_by_file) {
+            return;
+        }
+
+        // Only hit the atomic RMW the first time a page gets dirtied between flushes.
+        const u32 page = offset / PAGE_SIZE;
+        const u64 bit = u64(1) << (page % 64);
+        std::atomic<u64>& word = dirty_pages[page / 64];
+        if (!(word.load(std::memory_order_relaxed) & bit)) {
+            word.fetch_or(bit, std::memory_order_release);
+        }
+    }
+
+    u32 GetSize() const { return size; }
+    bool IsBackedByFile() const { return backed_by_file; }
+
+    // Wakes the flush thread up immediately (e.g. when the game disables RAM).
+    void RequestFlush();
+    void SetFlushInterval(std::chrono::milliseconds interval);
+
+private:
+    bool MapSaveFile(const std::filesystem::path& save_path);
+    void FlushThread();
+    void FlushDirtyPages();
+
+    u32 size = 0;
+    u32 mask = 0;
+    u8* data = nullptr;
+    std::vector<u8> memory; // used when there's no battery, or the save file couldn't be mapped
+
+    bool backed_by_file = false;
+    int fd = -1;
+    std::array<std::atomic<u64>, MAX_SIZE / PAGE_SIZE / 64> dirty_pages {};
+
+    std::thread flush_thread;
+    std::mutex flush_mutex;
+    std::condition_variable flush_cv;
+    std::chrono::milliseconds flush_interval = DEFAULT_FLUSH_INTERVAL;
+    bool flush_requested = false;
+    bool stopping = false;
+};
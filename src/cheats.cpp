@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cctype>
+#include "cheats.h"
+#include "logging.h"
+
+static std::string NormalizeCode(std::string_view code) {
+    std::string normalized;
+    for (char c : code) {
+        if (c == '-' || std::isspace(static_cast<unsigned char>(c))) {
+            continue;
+        }
+        normalized.push_back(static_cast<char>(std::toupper(static_cast<unsigned char>(c))));
+    }
+
+    return normalized;
+}
+
+static std::optional<std::array<u8, 9>> ParseHexDigits(std::string_view digits) {
+    std::array<u8, 9> result {};
+    if (digits.size() > result.size()) {
+        return std::nullopt;
+    }
+
+    for (size_t i = 0; i < digits.size(); i++) {
+        const char c = digits[i];
+        if (c >= '0' && c <= '9') {
+            result[i] = c - '0';
+        } else if (c >= 'A' && c <= 'F') {
+            result[i] = c - 'A' + 10;
+        } else {
+            return std::nullopt;
+        }
+    }
+
+    return result;
+}
+
+std::optional<Cheats::ROMPatch> Cheats::ParseGameGenie(std::string_view code) {
+    if (code.size() != 6 && code.size() != 9) {
+        return std::nullopt;
+    }
+
+    const auto digits = ParseHexDigits(code);
+    if (!digits.has_value()) {
+        return std::nullopt;
+    }
+
+    const auto& d = *digits;
+
+    ROMPatch patch;
+    patch.value = (d[0] << 4) | d[1];
+    patch.addr = ((d[5] ^ 0xF) << 12) | (d[2] << 8) | (d[3] << 4) | d[4];
+
+    if (code.size() == 9) {
+        // Digit 8 isn't used by the hardware.
+        u8 compare = (d[6] << 4) | d[8];
+        compare = static_cast<u8>((compare >> 2) | (compare << 6));
+        patch.compare = compare ^ 0xBA;
+    }
+
+    // Game Genie only patches ROM.
+    if (patch.addr >= 0x8000) {
+        return std::nullopt;
+    }
+
+    return patch;
+}
+
+std::optional<Cheats::RAMWrite> Cheats::ParseGameShark(std::string_view code) {
+    if (code.size() != 8) {
+        return std::nullopt;
+    }
+
+    const auto digits = ParseHexDigits(code);
+    if (!digits.has_value()) {
+        return std::nullopt;
+    }
+
+    const auto& d = *digits;
+
+    // The first byte selects an external RAM bank, which we don't support yet.
+    RAMWrite write;
+    write.value = (d[2] << 4) | d[3];
+    write.addr = (d[6] << 12) | (d[7] << 8) | (d[4] << 4) | d[5];
+    return write;
+}
+
+bool Cheats::Add(std::string_view code) {
+    const std::string normalized = NormalizeCode(code);
+
+    if (normalized.size() == 8) {
+        const auto write = ParseGameShark(normalized);
+        if (!write.has_value()) {
+            LERROR("cheats: invalid GameShark code {}", code);
+            return false;
+        }
+
+        LINFO("cheats: GameShark {} writes 0x{:02X} to 0x{:04X}", normalized, write->value, write->addr);
+        ram_cheats.emplace_back(normalized, *write);
+        RebuildRAMWrites();
+        return true;
+    }
+
+    const auto patch = ParseGameGenie(normalized);
+    if (!patch.has_value()) {
+        LERROR("cheats: invalid Game Genie code {}", code);
+        return false;
+    }
+
+    LINFO("cheats: Game Genie {} patches 0x{:04X} to 0x{:02X}", normalized, patch->addr, patch->value);
+    rom_patches.emplace_back(normalized, *patch);
+    return true;
+}
+
+void Cheats::Remove(std::string_view code) {
+    const std::string normalized = NormalizeCode(code);
+    std::erase_if(rom_patches, [&](const auto& entry) { return entry.first == normalized; });
+    std::erase_if(ram_cheats, [&](const auto& entry) { return entry.first == normalized; });
+    RebuildRAMWrites();
+}
+
+void Cheats::Clear() {
+    rom_patches.clear();
+    ram_cheats.clear();
+    ram_writes.clear();
+}
+
+void Cheats::RebuildRAMWrites() {
+    ram_writes.clear();
+    for (const auto& [code, write] : ram_cheats) {
+        ram_writes.push_back(write);
+    }
+}
+
+std::map<u32, std::array<u8, 0x100>> Cheats::BuildROMOverlay(std::span<const u8> rom) const {
+    std::map<u32, std::array<u8, 0x100>> overlay;
+
+    auto apply = [&](u32 offset, const ROMPatch& patch) {
+        if (offset >= rom.size()) {
+            return;
+        }
+
+        if (patch.compare.has_value() && rom[offset] != *patch.compare) {
+            return;
+        }
+
+        const u32 page = offset >> 8;
+        auto [it, inserted] = overlay.try_emplace(page);
+        if (inserted) {
+            std::copy_n(rom.begin() + (page << 8), 0x100, it->second.begin());
+        }
+        it->second[offset & 0xFF] = patch.value;
+    };
+
+    for (const auto& [code, patch] : rom_patches) {
+        if (patch.addr < 0x4000) {
+            apply(patch.addr, patch);
+            continue;
+        }
+
+        // The switchable bank region could hold any bank, so patch all of them.
+        // The compare byte is what keeps codes from hitting the wrong bank.
+        for (u32 bank = 1; bank < rom.size() / 0x4000; bank++) {
+            apply(bank * 0x4000 + (patch.addr - 0x4000), patch);
+        }
+    }
+
+    return overlay;
+}
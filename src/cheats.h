@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "common/types.h"
+
+// Game Genie codes patch ROM, GameShark codes write to RAM once per frame.
+class Cheats {
+public:
+    struct ROMPatch {
+        u16 addr = 0x0000;
+        u8 value = 0x00;
+        // Only patch banks where the original byte matches this.
+        std::optional<u8> compare {};
+    };
+
+    struct RAMWrite {
+        u16 addr = 0x0000;
+        u8 value = 0x00;
+    };
+
+    // Accepts Game Genie (ABC-DEF or ABC-DEF-GHI) and GameShark (ABCDEFGH) codes.
+    // Returns false if the code couldn't be parsed.
+    bool Add(std::string_view code);
+    void Remove(std::string_view code);
+    void Clear();
+
+    bool HasROMPatches() const { return !rom_patches.empty(); }
+    const std::vector<RAMWrite>& GetRAMWrites() const { return ram_writes; }
+
+    // Returns a patched copy of every 256-byte ROM page that a Game Genie code touches,
+    // keyed by page index. Untouched pages keep using the original ROM.
+    std::map<u32, std::array<u8, 0x100>> BuildROMOverlay(std::span<const u8> rom) const;
+
+private:
+    static std::optional<ROMPatch> ParseGameGenie(std::string_view code);
+    static std::optional<RAMWrite> ParseGameShark(std::string_view code);
+    void RebuildRAMWrites();
+
+    std::vector<std::pair<std::string, ROMPatch>> rom_patches;
+    std::vector<std::pair<std::string, RAMWrite>> ram_cheats;
+
+    // Compact copy of ram_cheats that's walked every frame.
+    std::vector<RAMWrite> ram_writes;
+};
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include "debug_views.h"
+#include "scanline.h"
+
+static constexpr u16 INVALID_CELL = 0xFFFF;
+
+static constexpr u32 GetShadeColor(u8 shade) {
+    const u32 gray = static_cast<u8>(~(shade * 0x55));
+    return gray << 24 | gray << 16 | gray << 8 | 0xFF;
+}
+
+DebugViews::DebugViews() {
+    // Nothing has been drawn yet, so every tile and cell needs drawing.
+    for (Snapshot& snapshot : snapshots) {
+        snapshot.tile_epochs.fill(~0u);
+        for (auto& cells : snapshot.cell_tiles) {
+            cells.fill(INVALID_CELL);
+        }
+    }
+}
+
+void DebugViews::Update(std::span<const u8, 0x2000> vram, std::span<const u8, 0xA0> oam, u8 lcdc, u8 bgp,
+                        std::span<const u32, 384> tile_epochs, u64 frame_number) {
+    Snapshot& snapshot = snapshots[back];
+
+    for (u16 tile_index = 0; tile_index < 384; tile_index++) {
+        if (snapshot.tile_epochs[tile_index] != tile_epochs[tile_index]) {
+            DrawAtlasTile(snapshot, vram, tile_index);
+            snapshot.tile_epochs[tile_index] = tile_epochs[tile_index];
+        }
+    }
+
+    // The tile maps are drawn through BGP, so every cell is stale when it changes.
+    if (snapshot.bgp != bgp) {
+        for (auto& cells : snapshot.cell_tiles) {
+            cells.fill(INVALID_CELL);
+        }
+        snapshot.bgp = bgp;
+    }
+
+    const bool is_signed = (lcdc & 0x10) == 0;
+    for (u8 map = 0; map < 2; map++) {
+        const u8* tile_map = &vram[map == 0 ? 0x1800 : 0x1C00];
+        for (u16 cell = 0; cell < 32 * 32; cell++) {
+            u16 tile_index = tile_map[cell];
+            if (is_signed && tile_index < 0x80) {
+                tile_index += 0x100;
+            }
+
+            if (snapshot.cell_tiles[map][cell] != tile_index || snapshot.cell_epochs[map][cell] != tile_epochs[tile_index]) {
+                DrawTileMapCell(snapshot, vram, map, cell, tile_index);
+                snapshot.cell_tiles[map][cell] = tile_index;
+                snapshot.cell_epochs[map][cell] = tile_epochs[tile_index];
+            }
+        }
+    }
+
+    std::copy(oam.begin(), oam.end(), snapshot.oam.begin());
+    snapshot.lcdc = lcdc;
+    snapshot.frame_number = frame_number;
+
+    // Publish the snapshot, and carry on with whichever one was the newest before.
+    back = latest.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+}
+
+const DebugViews::Snapshot& DebugViews::AcquireLatest() {
+    if (latest.load(std::memory_order_relaxed) & FRESH) {
+        front = latest.exchange(front, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+    return snapshots[front];
+}
+
+void DebugViews::DrawAtlasTile(Snapshot& snapshot, std::span<const u8, 0x2000> vram, u16 tile_index) {
+    u32* out = &snapshot.tile_atlas[(tile_index / 16) * 8 * ATLAS_WIDTH + (tile_index % 16) * 8];
+    for (u8 row = 0; row < 8; row++) {
+        const u16 addr = tile_index * 16 + row * 2;
+        const u64 indices = Scanline::DecodeTileRow(vram[addr], vram[addr + 1]);
+        for (u8 x = 0; x < 8; x++) {
+            out[row * ATLAS_WIDTH + x] = GetShadeColor((indices >> (x * 8)) & 0b11);
+        }
+    }
+}
+
+void DebugViews::DrawTileMapCell(Snapshot& snapshot, std::span<const u8, 0x2000> vram, u8 map, u16 cell, u16 tile_index) {
+    u32* out = &snapshot.tile_maps[map][(cell / 32) * 8 * TILE_MAP_SIZE + (cell % 32) * 8];
+    const u8 bgp = snapshot.bgp;
+    for (u8 row = 0; row < 8; row++) {
+        const u16 addr = tile_index * 16 + row * 2;
+        const u64 indices = Scanline::DecodeTileRow(vram[addr], vram[addr + 1]);
+        for (u8 x = 0; x < 8; x++) {
+            const u8 index = (indices >> (x * 8)) & 0b11;
+            out[row * TILE_MAP_SIZE + x] = GetShadeColor((bgp >> (index * 2)) & 0b11);
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <span>
+#include "common/types.h"
+
+// Debug views of VRAM and OAM for the frontends: every tile in an atlas, both tile maps, and
+// the raw OAM entries. The PPU updates them at the end of every frame, on the emulator thread,
+// redrawing only the tiles and tile map cells that changed. Finished snapshots are handed to
+// the UI through a triple buffer, so the UI never waits for the emulator or reads VRAM while
+// it's being written, and the emulator never waits for the UI.
+class DebugViews {
+public:
+    // Pixels are RGBA8888, packed native-endian as 0xRRGGBBAA.
+    static constexpr u32 ATLAS_WIDTH = 16 * 8;
+    static constexpr u32 ATLAS_HEIGHT = 24 * 8;
+    static constexpr u32 TILE_MAP_SIZE = 32 * 8;
+
+    struct Snapshot {
+        // All 384 tiles in VRAM bank 0, 16 to a row, in raw shades (color index 0 is white).
+        std::array<u32, ATLAS_WIDTH * ATLAS_HEIGHT> tile_atlas;
+        // The tile maps at 0x9800 and 0x9C00, through BGP, with the tile data addressing LCDC selected.
+        std::array<std::array<u32, TILE_MAP_SIZE * TILE_MAP_SIZE>, 2> tile_maps;
+        std::array<u8, 0xA0> oam;
+        u8 lcdc;
+        u64 frame_number;
+
+    private:
+        friend class DebugViews;
+
+        // What each part of this snapshot was last drawn with, like the PPU's background planes,
+        // so a snapshot catches up on everything that changed since it was last the one written.
+        std::array<u32, 384> tile_epochs;
+        std::array<std::array<u16, 32 * 32>, 2> cell_tiles;
+        std::array<std::array<u32, 32 * 32>, 2> cell_epochs;
+        u8 bgp;
+    };
+
+    DebugViews();
+
+    // Called by the PPU at the end of every frame, while the debug views are attached.
+    void Update(std::span<const u8, 0x2000> vram, std::span<const u8, 0xA0> oam, u8 lcdc, u8 bgp,
+                std::span<const u32, 384> tile_epochs, u64 frame_number);
+
+    // The newest finished snapshot. It stays untouched until the next call, which is the
+    // only thing the UI thread may call.
+    const Snapshot& AcquireLatest();
+
+private:
+    void DrawAtlasTile(Snapshot& snapshot, std::span<const u8, 0x2000> vram, u16 tile_index);
+    void DrawTileMapCell(Snapshot& snapshot, std::span<const u8, 0x2000> vram, u8 map, u16 cell, u16 tile_index);
+
+    static constexpr u8 FRESH = 0x4;
+    static constexpr u8 INDEX_MASK = 0x3;
+
+    // Three snapshots: the one being written, the one being read, and the newest finished one,
+    // whose index is in `latest` along with whether the UI has seen it yet.
+    std::array<Snapshot, 3> snapshots {};
+    u8 back = 0;
+    std::atomic<u8> latest = 1;
+    u8 front = 2;
+};
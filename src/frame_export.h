@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include "common/types.h"
+#include "ppu.h"
+
+// The layout of the POSIX shared memory segment FrameExporter publishes frames into, shared
+// with the viewers that read it. The segment is a ring of slots, each guarded by a seqlock:
+// the emulator never waits for readers, and a reader that was lapped while copying a slot
+// notices and tries again.
+namespace FrameExport {
+
+static constexpr u32 MAGIC = 0x46474C48; // "HLGF"
+static constexpr u32 VERSION = 2;
+static constexpr u32 SLOT_COUNT = 4;
+
+// The segment for an instance is /heliage-<instance name>.
+inline std::string GetSegmentName(const std::string& instance_name) {
+    return "/heliage-" + instance_name;
+}
+
+struct FrameInfo {
+    // Counts every frame since power on, including skipped ones.
+    u64 frame_number = 0;
+    // When the frame was finished, in nanoseconds since the Unix epoch.
+    u64 timestamp_ns = 0;
+    // See PPU::GetFrameHash. Frames with the same hash look the same.
+    u64 frame_hash = 0;
+    PPU::PixelFormat pixel_format = PPU::PixelFormat::ARGB8888;
+    // Lines are packed, so this is always 160 pixels' worth.
+    u32 pitch = 0;
+    PPU::TileCacheStats tile_cache_stats {};
+    PPU::LineReuseStats line_reuse_stats {};
+};
+
+using Pixels = std::array<u8, 160 * 144 * 4>;
+
+struct Slot {
+    // Odd while the slot is being written.
+    std::atomic<u32> sequence;
+    FrameInfo info;
+    alignas(64) Pixels pixels;
+};
+
+struct Segment {
+    u32 magic;
+    u32 version;
+    // The newest complete frame is in slot (frames_published - 1) % SLOT_COUNT.
+    std::atomic<u64> frames_published;
+    Slot slots[SLOT_COUNT];
+};
+
+// The atomics are shared between processes, which only works if they're lock-free.
+static_assert(std::atomic<u32>::is_always_lock_free && std::atomic<u64>::is_always_lock_free);
+
+// Copies the newest complete frame out of the segment. Returns false if nothing has been
+// published yet, or the emulator kept overwriting the slot while it was being copied.
+inline bool ReadLatestFrame(const Segment& segment, FrameInfo& info, Pixels& pixels) {
+    for (u32 attempt = 0; attempt < 4; attempt++) {
+        const u64 frames_published = segment.frames_published.load(std::memory_order_acquire);
+        if (frames_published == 0) {
+            return false;
+        }
+
+        const Slot& slot = segment.slots[(frames_published - 1) % SLOT_COUNT];
+        const u32 sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence % 2 != 0) {
+            continue;
+        }
+
+        // The info might be torn, so the pitch can't be trusted until the sequence is checked.
+        std::memcpy(&info, &slot.info, sizeof(info));
+        std::memcpy(pixels.data(), slot.pixels.data(), std::min<u32>(info.pitch, 160 * 4) * 144);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == sequence) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+}
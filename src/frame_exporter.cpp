@@ -0,0 +1,86 @@
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "frame_exporter.h"
+#include "logging.h"
+
+FrameExporter::FrameExporter(const std::string& instance_name)
+    : segment_name(FrameExport::GetSegmentName(instance_name)) {
+    if (instance_name.empty() || instance_name.find('/') != std::string::npos) {
+        LERROR("frame exporter: invalid instance name \"{}\"", instance_name);
+        return;
+    }
+
+    const int fd = shm_open(segment_name.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        LERROR("frame exporter: could not open shared memory {}: {}", segment_name, std::strerror(errno));
+        return;
+    }
+
+    if (ftruncate(fd, sizeof(FrameExport::Segment)) != 0) {
+        LERROR("frame exporter: could not resize shared memory {}: {}", segment_name, std::strerror(errno));
+        close(fd);
+        shm_unlink(segment_name.c_str());
+        return;
+    }
+
+    void* mapping = mmap(nullptr, sizeof(FrameExport::Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // The mapping keeps the segment alive on its own.
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        LERROR("frame exporter: could not map shared memory {}: {}", segment_name, std::strerror(errno));
+        shm_unlink(segment_name.c_str());
+        return;
+    }
+
+    // Start from scratch, in case this is a segment a crashed run didn't get to remove.
+    segment = new (mapping) FrameExport::Segment {};
+    segment->magic = FrameExport::MAGIC;
+    segment->version = FrameExport::VERSION;
+
+    LINFO("frame exporter: publishing frames to {}", segment_name);
+}
+
+FrameExporter::~FrameExporter() {
+    if (segment) {
+        munmap(segment, sizeof(FrameExport::Segment));
+        // Viewers that still have it mapped keep the last frames, the name just goes away.
+        shm_unlink(segment_name.c_str());
+    }
+}
+
+void FrameExporter::Publish(const PPU::RenderTarget& frame, PPU::PixelFormat format, u64 frame_number, u64 frame_hash,
+                            const PPU::TileCacheStats& tile_cache_stats, const PPU::LineReuseStats& line_reuse_stats) {
+    if (!segment) {
+        return;
+    }
+
+    FrameExport::Slot& slot = segment->slots[frames_published % FrameExport::SLOT_COUNT];
+    const u32 sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    // Readers that see any of the writes below also see the odd sequence.
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const u32 pitch = 160 * PPU::GetBytesPerPixel(format);
+    const auto now = std::chrono::system_clock::now().time_since_epoch();
+    slot.info = {
+        .frame_number = frame_number,
+        .timestamp_ns = static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count()),
+        .frame_hash = frame_hash,
+        .pixel_format = format,
+        .pitch = pitch,
+        .tile_cache_stats = tile_cache_stats,
+        .line_reuse_stats = line_reuse_stats,
+    };
+    for (u32 line = 0; line < 144; line++) {
+        std::memcpy(&slot.pixels[line * pitch], frame.pixels + line * frame.pitch, pitch);
+    }
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    frames_published++;
+    segment->frames_published.store(frames_published, std::memory_order_release);
+}
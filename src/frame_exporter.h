@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include "common/types.h"
+#include "frame_export.h"
+#include "ppu.h"
+
+// Publishes every drawn frame, with its frame number, a timestamp and the PPU's stats, into
+// a POSIX shared memory segment (see frame_export.h), so headless instances can be watched
+// from another process, e.g. with tools/frame_viewer.cpp. Publishing never waits for readers.
+class FrameExporter {
+public:
+    // Creates the segment for the instance, replacing one left behind by an earlier run.
+    explicit FrameExporter(const std::string& instance_name);
+    ~FrameExporter();
+
+    FrameExporter(const FrameExporter&) = delete;
+    FrameExporter& operator=(const FrameExporter&) = delete;
+
+    bool IsOpen() const { return segment != nullptr; }
+
+    void Publish(const PPU::RenderTarget& frame, PPU::PixelFormat format, u64 frame_number, u64 frame_hash,
+                 const PPU::TileCacheStats& tile_cache_stats, const PPU::LineReuseStats& line_reuse_stats);
+
+private:
+    std::string segment_name;
+    FrameExport::Segment* segment = nullptr;
+    u64 frames_published = 0;
+};
@@ -3,47 +3,166 @@
 #include <imgui/examples/imgui_impl_opengl2.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <mutex>
+#include <optional>
 #include <thread>
 #include "../cartridge.h"
+#include "../debug_views.h"
 #include "../gb.h"
 #include "../joypad.h"
 #include "../logging.h"
 #include "../ppu.h"
 
 std::thread emu_thread;
-std::array<u32, 160 * 144> fb;
+// The PPU draws frames into these in turn. fb is the last finished one, which the PPU leaves
+// alone while it draws the next frame into the other, and fb_hash is its frame hash.
+std::array<std::array<u32, 160 * 144>, 2> fb_buffers;
+std::mutex fb_mutex;
+const u32* fb = fb_buffers[0].data();
+u64 fb_hash = 0;
+PPU* ppu;
 bool done = false;
 bool power = true;
-GLuint gl_fb_texture;
+GLuint gl_fb_texture = 0;
+// The frame hash of what's in the texture, so it's only uploaded when the frame changes.
+std::optional<u64> uploaded_fb_hash;
+
+// Attached to the PPU while the VRAM viewer is updating. Its textures are only uploaded when
+// a new snapshot comes in.
+DebugViews debug_views;
+bool update_debug_views = false;
+GLuint gl_tile_atlas_texture = 0;
+std::array<GLuint, 2> gl_tile_map_textures {};
+std::optional<u64> uploaded_debug_frame;
 
 bool debugger_draw_background = true;
 bool debugger_draw_window = true;
 bool debugger_draw_sprites = true;
+bool use_pixel_fifo = false;
+int line_scheduling = 0;
+int frameskip_skipped = 0;
+int frameskip_period = 1;
+
+char watchpoint_addr_input[5] = "C000";
+char watchpoint_value_input[3] = "";
+bool watchpoint_on_read = false;
+bool watchpoint_on_write = true;
+bool watchpoint_break = true;
 
 void FramebufferToTexture(int* texture_width, int* texture_height, GLuint* framebuffer_texture) {
-    glGenTextures(1, &gl_fb_texture);
-    glBindTexture(GL_TEXTURE_2D, gl_fb_texture);
+    if (gl_fb_texture == 0) {
+        glGenTextures(1, &gl_fb_texture);
+        glBindTexture(GL_TEXTURE_2D, gl_fb_texture);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 160, 144, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, nullptr);
+    }
 
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 160, 144, 0, GL_RGBA, GL_UNSIGNED_BYTE, fb.data());
+    std::lock_guard lock(fb_mutex);
+    if (uploaded_fb_hash != fb_hash) {
+        glBindTexture(GL_TEXTURE_2D, gl_fb_texture);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 160, 144, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, fb);
+        uploaded_fb_hash = fb_hash;
+    }
 
     *framebuffer_texture = gl_fb_texture;
     *texture_width = 160 * 2;
     *texture_height = 144 * 2;
 }
 
-u32 GetRGBAColor(u8 color) {
-    u8 result = ~(color * 0x55);
-    return 0xFF << 24 | (result << 16) | (result << 8) | result;
+GLuint CreateTexture(int width, int height) {
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, nullptr);
+    return texture;
+}
+
+void UploadTexture(GLuint texture, int width, int height, const u32* pixels) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, pixels);
 }
 
-void DrawFramebuffer(std::array<PPU::Color, 160 * 144>& framebuffer) {
-    for (u32 i = 0; i < framebuffer.size(); i++) {
-        fb[i] = GetRGBAColor(static_cast<u8>(framebuffer[i]));
+void DrawVRAMViewer() {
+    ImGui::Begin("VRAM viewer");
+
+    if (ImGui::Checkbox("Update", &update_debug_views)) {
+        ppu->AttachDebugViews(update_debug_views ? &debug_views : nullptr);
+    }
+
+    if (!update_debug_views) {
+        ImGui::End();
+        return;
+    }
+
+    if (gl_tile_atlas_texture == 0) {
+        gl_tile_atlas_texture = CreateTexture(DebugViews::ATLAS_WIDTH, DebugViews::ATLAS_HEIGHT);
+        for (GLuint& texture : gl_tile_map_textures) {
+            texture = CreateTexture(DebugViews::TILE_MAP_SIZE, DebugViews::TILE_MAP_SIZE);
+        }
+    }
+
+    // Reading the snapshot doesn't touch VRAM or wait for the emulator thread.
+    const DebugViews::Snapshot& snapshot = debug_views.AcquireLatest();
+    if (uploaded_debug_frame != snapshot.frame_number) {
+        UploadTexture(gl_tile_atlas_texture, DebugViews::ATLAS_WIDTH, DebugViews::ATLAS_HEIGHT, snapshot.tile_atlas.data());
+        for (u32 map = 0; map < 2; map++) {
+            UploadTexture(gl_tile_map_textures[map], DebugViews::TILE_MAP_SIZE, DebugViews::TILE_MAP_SIZE, snapshot.tile_maps[map].data());
+        }
+        uploaded_debug_frame = snapshot.frame_number;
+    }
+
+    ImGui::Text("Frame %llu", static_cast<unsigned long long>(snapshot.frame_number));
+    const ImTextureID atlas = (void*)(intptr_t)gl_tile_atlas_texture;
+
+    if (ImGui::CollapsingHeader("Tiles")) {
+        ImGui::Image(atlas, ImVec2(DebugViews::ATLAS_WIDTH * 2, DebugViews::ATLAS_HEIGHT * 2));
+    }
+
+    const char* map_names[] = { "Tile map 9800", "Tile map 9C00" };
+    for (u32 map = 0; map < 2; map++) {
+        if (ImGui::CollapsingHeader(map_names[map])) {
+            ImGui::Image((void*)(intptr_t)gl_tile_map_textures[map], ImVec2(DebugViews::TILE_MAP_SIZE * 2, DebugViews::TILE_MAP_SIZE * 2));
+        }
+    }
+
+    if (ImGui::CollapsingHeader("OAM")) {
+        const bool tall_sprites = (snapshot.lcdc & 0x04) != 0;
+        for (u32 i = 0; i < 40; i++) {
+            const u8* entry = &snapshot.oam[i * 4];
+            const u8 tile_index = tall_sprites ? (entry[2] & ~0x1) : entry[2];
+
+            // The sprite's tiles, straight out of the atlas. Tall sprites show both, side by side.
+            for (u32 tile = tile_index; tile <= (tall_sprites ? tile_index + 1u : tile_index); tile++) {
+                const ImVec2 uv0((tile % 16) * 8.0f / DebugViews::ATLAS_WIDTH, (tile / 16) * 8.0f / DebugViews::ATLAS_HEIGHT);
+                const ImVec2 uv1(uv0.x + 8.0f / DebugViews::ATLAS_WIDTH, uv0.y + 8.0f / DebugViews::ATLAS_HEIGHT);
+                ImGui::Image(atlas, ImVec2(16, 16), uv0, uv1);
+                ImGui::SameLine(0, 0);
+            }
+            ImGui::SameLine();
+            ImGui::Text("%2u: x=%3d y=%3d tile=%02X flags=%02X", i, entry[1] - 8, entry[0] - 16, entry[2], entry[3]);
+        }
+    }
+
+    ImGui::End();
+}
+
+void DrawFramebuffer(const PPU::RenderTarget& frame) {
+    // The PPU renders RGBA8888 into one of fb_buffers, which is what the texture upload expects.
+    {
+        std::lock_guard lock(fb_mutex);
+        fb = reinterpret_cast<const u32*>(frame.pixels);
+        fb_hash = ppu->GetFrameHash();
     }
 
     SDL_Delay(1000 / 60);
@@ -74,12 +193,25 @@ void HandleEvents(Joypad* joypad) {
 }
 
 void Run(GB* gb) {
+    Bus* bus = gb->GetBus();
     while (!done && power) {
         gb->Run();
+
+        if (bus->IsWatchpointBreakPending()) {
+            bus->ClearWatchpointBreak();
+            power = false;
+        }
+    }
+}
+
+void StopEmulation() {
+    power = false;
+    if (emu_thread.joinable()) {
+        emu_thread.join();
     }
 }
 
-int main_imgui(char* argv[]) {
+int main_imgui(char* argv[], const std::optional<std::string>& instance_name) {
     std::filesystem::path bootrom_path = argv[1];
     std::filesystem::path cartridge_path = argv[2];
 
@@ -91,6 +223,13 @@ int main_imgui(char* argv[]) {
 
     Cartridge cartridge(cartridge_path);
     GB gb(bootrom, cartridge);
+    ppu = gb.GetPPU();
+    if (instance_name) {
+        gb.GetPPU()->ExportFrames(*instance_name);
+    }
+    gb.GetPPU()->SetRenderTargets(PPU::PixelFormat::RGBA8888,
+                                  { reinterpret_cast<u8*>(fb_buffers[0].data()), 160 * sizeof(u32) },
+                                  { reinterpret_cast<u8*>(fb_buffers[1].data()), 160 * sizeof(u32) });
 
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
     {
@@ -204,16 +343,108 @@ int main_imgui(char* argv[]) {
                 gb.GetPPU()->SetSpriteDrawingEnabled(debugger_draw_sprites);
             }
 
+            ImGui::Separator();
+
+            // The pixel FIFO renderer is slower, but handles mid-line effects
+            if (ImGui::Checkbox("Pixel FIFO renderer", &use_pixel_fifo)) {
+                gb.GetPPU()->SetRenderer(use_pixel_fifo ? PPU::Renderer::PixelFIFO : PPU::Renderer::Scanline);
+            }
+
+            // Where the scanline renderer draws its lines
+            const char* line_scheduling_names[] = { "Immediate", "Deferred", "Worker thread" };
+            if (ImGui::Combo("Line drawing", &line_scheduling, line_scheduling_names, IM_ARRAYSIZE(line_scheduling_names))) {
+                gb.GetPPU()->SetLineScheduling(static_cast<PPU::LineScheduling>(line_scheduling));
+            }
+
+            // Skip N of every M frames
+            bool frameskip_changed = ImGui::InputInt("Frames skipped", &frameskip_skipped);
+            frameskip_changed |= ImGui::InputInt("Out of every", &frameskip_period);
+            if (frameskip_changed) {
+                frameskip_period = std::max(frameskip_period, 1);
+                frameskip_skipped = std::clamp(frameskip_skipped, 0, frameskip_period);
+                gb.GetPPU()->SetFrameskip(frameskip_skipped, frameskip_period);
+            }
+
+            ImGui::Separator();
+
+            const auto& tile_cache_stats = gb.GetPPU()->GetTileCacheStats();
+            ImGui::Text("Tiles decoded last frame: %u", tile_cache_stats.tiles_decoded);
+            ImGui::Text("Tile data writes last frame: %u", tile_cache_stats.tile_writes);
+
+            const auto& line_reuse_stats = gb.GetPPU()->GetLineReuseStats();
+            ImGui::Text("Lines reused last frame: %u", line_reuse_stats.lines_reused);
+            ImGui::Text("Lines rendered last frame: %u", line_reuse_stats.lines_rendered);
+
             ImGui::End();
         }
 
+        {
+            ImGui::Begin("Watchpoints");
+
+            ImGui::InputText("Address", watchpoint_addr_input, sizeof(watchpoint_addr_input), ImGuiInputTextFlags_CharsHexadecimal);
+            ImGui::InputText("Value (optional)", watchpoint_value_input, sizeof(watchpoint_value_input), ImGuiInputTextFlags_CharsHexadecimal);
+            ImGui::Checkbox("Read", &watchpoint_on_read);
+            ImGui::SameLine();
+            ImGui::Checkbox("Write", &watchpoint_on_write);
+            ImGui::SameLine();
+            ImGui::Checkbox("Break", &watchpoint_break);
+
+            if (ImGui::Button("Add") && watchpoint_addr_input[0] != '\0') {
+                Bus::Watchpoint watchpoint;
+                watchpoint.addr = static_cast<u16>(std::strtoul(watchpoint_addr_input, nullptr, 16));
+                watchpoint.on_read = watchpoint_on_read;
+                watchpoint.on_write = watchpoint_on_write;
+                watchpoint.break_on_hit = watchpoint_break;
+                if (watchpoint_value_input[0] != '\0') {
+                    watchpoint.value = static_cast<u8>(std::strtoul(watchpoint_value_input, nullptr, 16));
+                }
+
+                // The watchpoint tables can't be touched while the emulation thread is running.
+                const bool was_powered = power;
+                StopEmulation();
+                gb.GetBus()->AddWatchpoint(watchpoint);
+                power = was_powered;
+            }
+
+            ImGui::Separator();
+
+            std::optional<u16> watchpoint_to_remove;
+            for (const Bus::Watchpoint& watchpoint : gb.GetBus()->GetWatchpoints()) {
+                ImGui::Text("%04X %s%s", watchpoint.addr, watchpoint.on_read ? "R" : "", watchpoint.on_write ? "W" : "");
+                ImGui::SameLine();
+                ImGui::PushID(watchpoint.addr);
+                if (ImGui::SmallButton("Remove")) {
+                    watchpoint_to_remove = watchpoint.addr;
+                }
+                ImGui::PopID();
+            }
+
+            if (watchpoint_to_remove.has_value()) {
+                const bool was_powered = power;
+                StopEmulation();
+                gb.GetBus()->RemoveWatchpoint(*watchpoint_to_remove);
+                power = was_powered;
+            }
+
+            ImGui::Separator();
+
+            for (const Bus::WatchpointHit& hit : gb.GetBus()->GetWatchpointHits()) {
+                ImGui::Text("%s %04X = %02X (PC=%04X, cycle %llu)", hit.write ? "W" : "R", hit.addr, hit.value, hit.pc,
+                            static_cast<unsigned long long>(hit.cycle));
+            }
+
+            ImGui::End();
+        }
+
+        DrawVRAMViewer();
+
         {
             ImGui::Begin("Memory viewer");
 
             for (u32 i = 0x0000; i < 0x10000; i += 0x10) {
                 ImGui::Text("%04X ", i);
                 for (u16 j = 0x0; j < 0x10; j++) {
-                    u8 byte = gb.GetBus()->Read8(static_cast<u16>(i + j), false);
+                    u8 byte = gb.GetBus()->Peek8(static_cast<u16>(i + j));
                     ImGui::SameLine();
                     ImGui::Text("%02X", byte);
                 }
@@ -226,6 +457,9 @@ int main_imgui(char* argv[]) {
             if (!emu_thread.joinable()) {
                 emu_thread = std::thread(&Run, &gb);
             }
+        } else if (emu_thread.joinable()) {
+            // Powered off from the menu or by a watchpoint, so the thread has exited (or is about to).
+            emu_thread.join();
         }
 
         // Rendering
@@ -236,14 +470,22 @@ int main_imgui(char* argv[]) {
         //glUseProgram(0); // You may want this if using this code in an OpenGL 3+ context where shaders may be bound
         ImGui_ImplOpenGL2_RenderDrawData(ImGui::GetDrawData());
         SDL_GL_SwapWindow(window);
+    }
 
-        glDeleteTextures(1, &gl_fb_texture);
+    glDeleteTextures(1, &gl_fb_texture);
+    if (gl_tile_atlas_texture != 0) {
+        glDeleteTextures(1, &gl_tile_atlas_texture);
+        glDeleteTextures(2, gl_tile_map_textures.data());
     }
 
     if (emu_thread.joinable()) {
         emu_thread.join();
     }
 
+#ifdef HELIAGE_MEMORY_PROFILING
+    gb.GetBus()->DumpMemoryProfile();
+#endif
+
     // Cleanup
     ImGui_ImplOpenGL2_Shutdown();
     ImGui_ImplSDL2_Shutdown();
@@ -1,11 +1,13 @@
 #pragma once
 
 #include <array>
+#include <optional>
+#include <string>
 #include <thread>
 #include "../joypad.h"
 #include "../ppu.h"
 #include "../common/types.h"
 
-void DrawFramebuffer(std::array<PPU::Color, 160 * 144>& framebuffer);
+void DrawFramebuffer(const PPU::RenderTarget& frame);
 void HandleEvents(Joypad* joypad);
-int main_imgui(char* argv[]);
+int main_imgui(char* argv[], const std::optional<std::string>& instance_name);
@@ -1,16 +1,24 @@
+#include <csignal>
 #include <filesystem>
 #include "../bootrom.h"
 #include "../cartridge.h"
 #include "../logging.h"
 #include "null.h"
 
+// Set by SIGINT or SIGTERM. There's no window to close, so that's how a run ends.
+volatile std::sig_atomic_t stop_requested = 0;
+
+void RequestStop([[maybe_unused]] int signal) {
+    stop_requested = 1;
+}
+
 void HandleEvents([[maybe_unused]] Joypad* joypad) {
 }
 
-void DrawFramebuffer([[maybe_unused]] std::array<PPU::Color, 160 * 144>& framebuffer) {
+void DrawFramebuffer([[maybe_unused]] const PPU::RenderTarget& frame) {
 }
 
-int main_null(char* argv[]) {
+int main_null(char* argv[], const std::optional<std::string>& instance_name) {
     std::filesystem::path bootrom_path = argv[1];
     std::filesystem::path cart_path = argv[2];
 
@@ -26,10 +34,20 @@ int main_null(char* argv[]) {
     Cartridge cartridge(cart_path);
 
     GB gb(bootrom, cartridge);
+    if (instance_name) {
+        gb.GetPPU()->ExportFrames(*instance_name);
+    }
 
-    while (true) {
+    std::signal(SIGINT, RequestStop);
+    std::signal(SIGTERM, RequestStop);
+    while (!stop_requested) {
         gb.Run();
     }
 
+    LINFO("stopping after {} frames", gb.GetPPU()->GetFrameCount());
+#ifdef HELIAGE_MEMORY_PROFILING
+    gb.GetBus()->DumpMemoryProfile();
+#endif
+
     return 0;
 }
@@ -1,12 +1,14 @@
 #pragma once
 
 #include <array>
+#include <optional>
+#include <string>
 #include "../gb.h"
 #include "../joypad.h"
 #include "../ppu.h"
 
 // Unused
 void HandleEvents([[maybe_unused]] Joypad* joypad);
-void DrawFramebuffer([[maybe_unused]] std::array<PPU::Color, 160 * 144>& framebuffer);
+void DrawFramebuffer([[maybe_unused]] const PPU::RenderTarget& frame);
 
-int main_null(char* argv[]);
+int main_null(char* argv[], const std::optional<std::string>& instance_name);
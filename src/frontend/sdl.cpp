@@ -1,18 +1,51 @@
 #include <SDL2/SDL.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <filesystem>
+#include <optional>
 #include <string>
+#include <thread>
 #include "../bootrom.h"
 #include "../cartridge.h"
 #include "../logging.h"
+#include "../postprocess.h"
 #include "sdl.h"
+#include "sdl_window.h"
 
-SDL_Window* window;
-SDL_Renderer* renderer;
-SDL_Texture* framebuffer_output;
 SDL_Event event;
+PPU* ppu;
 
 bool running = false;
 
+// The frame hash of what's on screen, so frames that look the same aren't presented again.
+std::optional<u64> presented_frame_hash;
+// Presenting waits for vsync, which is what paces the emulator. Frames that aren't presented
+// are paced to the display's refresh rate instead.
+std::chrono::steady_clock::duration frame_period = std::chrono::microseconds(1'000'000 / 60);
+std::chrono::steady_clock::time_point last_frame_time;
+
+// F2 cycles through the scalers and F3 toggles LCD ghosting. With either on, the post-processor
+// draws the PPU's frames into the texture. It starts its worker threads, so it's only created
+// once one of them is first pressed.
+std::optional<PostProcessor> post_processor;
+// What F2 and F3 asked for. The locked texture was made for the current settings, so these are
+// only handed to the post-processor once the frame drawn with them has been presented.
+PostProcessor::Scaler requested_scaler = PostProcessor::Scaler::None;
+bool requested_ghosting = false;
+bool output_changed = false;
+
+PostProcessor& GetPostProcessor() {
+    if (!post_processor) {
+        post_processor.emplace();
+    }
+    return *post_processor;
+}
+
+bool IsPostProcessing() {
+    return post_processor && post_processor->IsEnabled();
+}
+
 void HandleEvents(Joypad* joypad) {
     while (SDL_PollEvent(&event)) {
         switch (event.type) {
@@ -27,6 +60,16 @@ void HandleEvents(Joypad* joypad) {
                 KEYDOWN(SDLK_BACKSPACE, Select);
                 KEYDOWN(SDLK_RETURN, Start);
 #undef KEYDOWN
+                if (event.key.keysym.sym == SDLK_F2) {
+                    const u32 next = (static_cast<u32>(requested_scaler) + 1) % PostProcessor::SCALER_COUNT;
+                    requested_scaler = static_cast<PostProcessor::Scaler>(next);
+                    output_changed = true;
+                    LINFO("upscaling {}x ({})", PostProcessor::GetScale(requested_scaler), PostProcessor::GetName(requested_scaler));
+                } else if (event.key.keysym.sym == SDLK_F3) {
+                    requested_ghosting = !requested_ghosting;
+                    output_changed = true;
+                    LINFO("LCD ghosting {}", requested_ghosting ? "on" : "off");
+                }
                 break;
             case SDL_KEYUP:
 #define KEYUP(k, button) if (event.key.keysym.sym == k) joypad->ReleaseButton(Joypad::Button::button)
@@ -40,6 +83,12 @@ void HandleEvents(Joypad* joypad) {
                 KEYUP(SDLK_RETURN, Start);
 #undef KEYUP
                 break;
+            case SDL_WINDOWEVENT:
+                if (event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                    // Whatever was on screen may be gone, so present the next frame even if it's the same.
+                    presented_frame_hash.reset();
+                }
+                break;
             case SDL_QUIT:
                 running = false;
                 break;
@@ -47,43 +96,116 @@ void HandleEvents(Joypad* joypad) {
     }    
 }
 
-u32 GetARGBColor(PPU::Color pixel) {
-    u8 color = ~(static_cast<u8>(pixel) * 0x55);
-    return 0xFF << 24 | color << 16 | color << 8 | color;
+// The locked texture, which is where the post-processor draws when it's enabled. Without
+// post-processing the texture is left unlocked, so it keeps what was uploaded into it.
+PPU::RenderTarget locked_output {};
+// The hash of every line uploaded into the texture, so only lines that changed are uploaded again.
+// Empty after the texture is (re)created, since it holds nothing yet.
+std::optional<std::array<u64, 144>> uploaded_line_hashes;
+
+// The PPU always draws into its own framebuffer, which stays put, so its line signatures stay
+// valid and lines can be reused from one frame to the next.
+bool LockFramebufferOutput() {
+    if (!IsPostProcessing()) {
+        return true;
+    }
+
+    void* pixels = nullptr;
+    int pitch = 0;
+    if (SDL_LockTexture(SDLWindow::texture, nullptr, &pixels, &pitch) != 0) {
+        LERROR("failed to lock framebuffer output texture: {}", SDL_GetError());
+        return false;
+    }
+
+    locked_output = { static_cast<u8*>(pixels), static_cast<u32>(pitch) };
+    return true;
 }
 
-void DrawFramebuffer(std::array<PPU::Color, 160 * 144>& framebuffer) {
-    SDL_RenderClear(renderer);
+// (Re)creates the texture at the post-processor's scale and locks it if the post-processor draws into it.
+bool CreateFramebufferOutput() {
+    const u32 scale = post_processor ? post_processor->GetScale() : 1;
+    if (!SDLWindow::CreateTexture(SDL_PIXELFORMAT_ARGB8888, 160 * scale, 144 * scale)) {
+        return false;
+    }
 
-    void* pixels;
+    locked_output = {};
+    uploaded_line_hashes.reset();
+    presented_frame_hash.reset();
+    return LockFramebufferOutput();
+}
 
-    // we don't use this, but SDL just *needs* us to have it
-    int pitch;
+// Uploads the lines of the frame that aren't in the texture yet, a run of consecutive lines at a time.
+bool UploadChangedLines(const PPU::RenderTarget& frame) {
+    const std::array<u64, 144>& line_hashes = ppu->GetLineHashes();
+    const auto is_uploaded = [&](u32 line) {
+        return uploaded_line_hashes && (*uploaded_line_hashes)[line] == line_hashes[line];
+    };
 
-    SDL_LockTexture(framebuffer_output, nullptr, &pixels, &pitch);
+    u32 line = 0;
+    while (line < 144) {
+        if (is_uploaded(line)) {
+            line++;
+            continue;
+        }
 
-    u32* pixel_array = static_cast<u32*>(pixels);
+        u32 end = line + 1;
+        while (end < 144 && !is_uploaded(end)) {
+            end++;
+        }
+
+        const SDL_Rect rect { 0, static_cast<int>(line), 160, static_cast<int>(end - line) };
+        if (SDL_UpdateTexture(SDLWindow::texture, &rect, frame.pixels + line * frame.pitch, static_cast<int>(frame.pitch)) != 0) {
+            LERROR("failed to update framebuffer output texture: {}", SDL_GetError());
+            return false;
+        }
+        line = end;
+    }
 
-    for (unsigned int i = 0; i < 160 * 144; i++) {
-        pixel_array[i] = GetARGBColor(framebuffer[i]);
+    uploaded_line_hashes = line_hashes;
+    return true;
+}
+
+void DrawFramebuffer(const PPU::RenderTarget& frame) {
+    // With ghosting, the picture keeps changing for a few frames after the frame stops changing.
+    const bool unchanged = !output_changed && !(post_processor && post_processor->IsGhostingEnabled());
+    if (unchanged && presented_frame_hash == ppu->GetFrameHash()) {
+        const auto now = std::chrono::steady_clock::now();
+        last_frame_time = std::max(last_frame_time + frame_period, now - frame_period);
+        std::this_thread::sleep_until(last_frame_time);
+        return;
     }
+    presented_frame_hash = ppu->GetFrameHash();
 
-    SDL_UnlockTexture(framebuffer_output);
+    if (IsPostProcessing()) {
+        post_processor->Process(frame, PPU::PixelFormat::ARGB8888, locked_output);
+        SDL_UnlockTexture(SDLWindow::texture);
+    } else if (!UploadChangedLines(frame)) {
+        running = false;
+        return;
+    }
+    SDLWindow::Present();
+    last_frame_time = std::chrono::steady_clock::now();
 
-    SDL_RenderCopy(renderer, framebuffer_output, nullptr, nullptr);
-    SDL_RenderPresent(renderer);
+    // The post-processor's output lives in the texture, so changes only take effect once it's been presented.
+    if (output_changed && (post_processor || requested_scaler != PostProcessor::Scaler::None || requested_ghosting)) {
+        PostProcessor& processor = GetPostProcessor();
+        processor.SetScaler(requested_scaler);
+        processor.SetGhostingEnabled(requested_ghosting);
+    }
+    const bool locked = output_changed ? CreateFramebufferOutput() : LockFramebufferOutput();
+    output_changed = false;
+    if (!locked) {
+        running = false;
+    }
 }
 
 void Shutdown() {
     LINFO("shutting down SDL");
-    SDL_DestroyTexture(framebuffer_output);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
+    SDLWindow::Shutdown();
     std::exit(0);
 }
 
-int main_SDL(char* argv[]) {
+int main_SDL(char* argv[], const std::optional<std::string>& instance_name) {
     std::filesystem::path bootrom_path = argv[1];
     std::filesystem::path cart_path = argv[2];
 
@@ -98,37 +220,31 @@ int main_SDL(char* argv[]) {
 
     Cartridge cartridge(cart_path);
 
-    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
-        LFATAL("failed to initialize SDL: {}", SDL_GetError());
+    if (!SDLWindow::Init()) {
         return 1;
     }
 
-    window = SDL_CreateWindow("heliage", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 160 * 2, 144 * 2, 0);
-    if (!window) {
-        LFATAL("failed to create SDL window: {}", SDL_GetError());
-        return 1;
+    SDL_DisplayMode display_mode {};
+    if (SDL_GetWindowDisplayMode(SDLWindow::window, &display_mode) == 0 && display_mode.refresh_rate != 0) {
+        frame_period = std::chrono::microseconds(1'000'000 / display_mode.refresh_rate);
     }
 
-    renderer = SDL_CreateRenderer(window, 0, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-    if (!renderer) {
-        LFATAL("failed to create SDL renderer: {}", SDL_GetError());
-        return 1;
+    GB gb(bootrom, cartridge);
+    if (instance_name) {
+        gb.GetPPU()->ExportFrames(*instance_name);
     }
-
-    framebuffer_output = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 160, 144);
-    if (!framebuffer_output) {
-        LFATAL("failed to create framebuffer output texture: {}", SDL_GetError());
+    ppu = gb.GetPPU();
+    ppu->SetPixelFormat(PPU::PixelFormat::ARGB8888);
+    if (!CreateFramebufferOutput()) {
         return 1;
     }
 
-    GB gb(bootrom, cartridge);
-
     std::string title = "heliage";
     std::string game_title = cartridge.GetGameTitle();
     if (!game_title.empty()) {
         title = "heliage - " + game_title;
     }
-    SDL_SetWindowTitle(window, title.c_str());
+    SDL_SetWindowTitle(SDLWindow::window, title.c_str());
 
     running = true;
     while (running) {
@@ -136,6 +252,9 @@ int main_SDL(char* argv[]) {
     }
 
     gb.GetBus()->DumpMemoryToFile();
+#ifdef HELIAGE_MEMORY_PROFILING
+    gb.GetBus()->DumpMemoryProfile();
+#endif
 
     Shutdown();
     return 0;
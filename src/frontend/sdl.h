@@ -1,11 +1,12 @@
 #pragma once
 
+#include <optional>
+#include <string>
 #include "../gb.h"
 #include "../ppu.h"
 #include "../common/types.h"
 
 void HandleEvents(Joypad* joypad);
-u32 GetARGBColor(PPU::Color pixel);
-void DrawFramebuffer(std::array<PPU::Color, 160 * 144>& framebuffer);
+void DrawFramebuffer(const PPU::RenderTarget& frame);
 void Shutdown();
-int main_SDL(char* argv[]);
+int main_SDL(char* argv[], const std::optional<std::string>& instance_name);
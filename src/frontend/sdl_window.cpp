@@ -0,0 +1,58 @@
+#include "../logging.h"
+#include "sdl_window.h"
+
+namespace SDLWindow {
+
+SDL_Window* window;
+SDL_Renderer* renderer;
+SDL_Texture* texture;
+
+bool Init() {
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+        LFATAL("failed to initialize SDL: {}", SDL_GetError());
+        return false;
+    }
+
+    window = SDL_CreateWindow("heliage", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 160 * 2, 144 * 2, 0);
+    if (!window) {
+        LFATAL("failed to create SDL window: {}", SDL_GetError());
+        return false;
+    }
+
+    renderer = SDL_CreateRenderer(window, 0, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if (!renderer) {
+        LFATAL("failed to create SDL renderer: {}", SDL_GetError());
+        return false;
+    }
+
+    return true;
+}
+
+bool CreateTexture(u32 format, u32 width, u32 height) {
+    if (texture) {
+        SDL_DestroyTexture(texture);
+    }
+
+    texture = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (!texture) {
+        LERROR("failed to create framebuffer output texture: {}", SDL_GetError());
+        return false;
+    }
+
+    return true;
+}
+
+void Present() {
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer);
+}
+
+void Shutdown() {
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+}
+
+}
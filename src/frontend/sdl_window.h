@@ -0,0 +1,22 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include "../common/types.h"
+
+// The window, renderer and streaming texture the SDL frontend and the frame viewer draw into.
+namespace SDLWindow {
+
+extern SDL_Window* window;
+extern SDL_Renderer* renderer;
+extern SDL_Texture* texture;
+
+// Initializes SDL video and opens a window at twice the Game Boy's resolution, with a renderer
+// that waits for vsync when presenting.
+bool Init();
+// Replaces the texture with a streaming one of the given SDL pixel format and size.
+bool CreateTexture(u32 format, u32 width, u32 height);
+// Stretches the texture over the whole window and presents it.
+void Present();
+void Shutdown();
+
+}
@@ -4,7 +4,7 @@
 #include "ppu.h"
 
 GB::GB(BootROM bootrom, Cartridge cartridge)
-    : bus(bootrom, cartridge, joypad, ppu, timer), ppu(bus), sm83(bus, timer), timer(bus, ppu) {
+    : bus(bootrom, cartridge, joypad, ppu, sm83, timer), ppu(bus), sm83(bus, timer), timer(bus, ppu) {
     LINFO("powering on...");
 }
 
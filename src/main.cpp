@@ -1,17 +1,25 @@
 #include <cstdio>
+#include <optional>
+#include <string>
 #include "frontend/frontend.h"
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        printf("usage: %s <bootrom> <cartridge>\n", argv[0]);
+    // The optional instance name turns on exporting frames to shared memory (see FrameExporter).
+    if (argc != 3 && argc != 4) {
+        printf("usage: %s <bootrom> <cartridge> [instance name]\n", argv[0]);
         return 1;
     }
 
+    std::optional<std::string> instance_name;
+    if (argc == 4) {
+        instance_name = argv[3];
+    }
+
 #if defined(HELIAGE_FRONTEND_SDL)
-    return main_SDL(argv);
+    return main_SDL(argv, instance_name);
 #elif defined(HELIAGE_FRONTEND_IMGUI)
-    return main_imgui(argv);
+    return main_imgui(argv, instance_name);
 #else
-    return main_null(argv);
+    return main_null(argv, instance_name);
 #endif
 }
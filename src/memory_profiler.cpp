@@ -0,0 +1,105 @@
+#include "logging.h"
+#include "memory_profiler.h"
+
+static constexpr const char* SOURCE_NAMES[] = { "CPU", "DMA", "PPU", "Internal" };
+
+void MemoryProfiler::SetFrameLog(const std::filesystem::path& path) {
+    frame_log.emplace(fmt::output_file(path.string()));
+    frame_log->print("frame,region,address,source,reads,writes\n");
+    LINFO("memory profiler: logging every frame to {}", path.string());
+}
+
+void MemoryProfiler::EndFrame() {
+    if (frame_log.has_value()) {
+        WriteCSVRows(*frame_log, frame_counts, frames);
+    }
+
+    Accumulate();
+    frames++;
+}
+
+void MemoryProfiler::Accumulate() {
+    auto add = [](Counters& total, Counters& frame) {
+        for (size_t source = 0; source < total.size(); source++) {
+            for (size_t i = 0; i < 0x100; i++) {
+                total[source][i] += frame[source][i];
+            }
+            frame[source].fill(0);
+        }
+    };
+
+    add(total_counts.reads, frame_counts.reads);
+    add(total_counts.writes, frame_counts.writes);
+    add(total_counts.io_reads, frame_counts.io_reads);
+    add(total_counts.io_writes, frame_counts.io_writes);
+}
+
+void MemoryProfiler::WriteCSVRows(fmt::ostream& file, const Counts& counts, std::optional<u64> frame) {
+    const std::string prefix = frame.has_value() ? fmt::format("{},", *frame) : "";
+
+    for (size_t source = 0; source < static_cast<size_t>(Source::Count); source++) {
+        for (size_t page = 0; page < 0x100; page++) {
+            const u64 reads = counts.reads[source][page];
+            const u64 writes = counts.writes[source][page];
+            if (reads || writes) {
+                file.print("{}page,0x{:02X}00,{},{},{}\n", prefix, page, SOURCE_NAMES[source], reads, writes);
+            }
+        }
+
+        for (size_t reg = 0; reg < 0x100; reg++) {
+            const u64 reads = counts.io_reads[source][reg];
+            const u64 writes = counts.io_writes[source][reg];
+            if (reads || writes) {
+                file.print("{}io,0xFF{:02X},{},{},{}\n", prefix, reg, SOURCE_NAMES[source], reads, writes);
+            }
+        }
+    }
+}
+
+void MemoryProfiler::ExportCSV(const std::filesystem::path& path) {
+    Accumulate();
+
+    auto file = fmt::output_file(path.string());
+    file.print("region,address,source,reads,writes\n");
+    WriteCSVRows(file, total_counts, std::nullopt);
+    file.close();
+
+    LINFO("memory profiler: wrote {}", path.string());
+}
+
+void MemoryProfiler::ExportJSON(const std::filesystem::path& path) {
+    Accumulate();
+
+    auto file = fmt::output_file(path.string());
+    file.print("{{\n  \"frames\": {},\n", frames);
+
+    auto write_region = [&](const char* name, const Counters& reads, const Counters& writes, const char* address_format) {
+        file.print("  \"{}\": [", name);
+        bool first = true;
+        for (size_t i = 0; i < 0x100; i++) {
+            bool any = false;
+            for (size_t source = 0; source < static_cast<size_t>(Source::Count); source++) {
+                any |= reads[source][i] || writes[source][i];
+            }
+            if (!any) {
+                continue;
+            }
+
+            file.print("{}\n    {{\"address\": \"{}\"", first ? "" : ",", fmt::format(fmt::runtime(address_format), i));
+            for (size_t source = 0; source < static_cast<size_t>(Source::Count); source++) {
+                file.print(", \"{}\": {{\"reads\": {}, \"writes\": {}}}", SOURCE_NAMES[source], reads[source][i], writes[source][i]);
+            }
+            file.print("}}");
+            first = false;
+        }
+        file.print("\n  ]");
+    };
+
+    write_region("pages", total_counts.reads, total_counts.writes, "0x{:02X}00");
+    file.print(",\n");
+    write_region("io", total_counts.io_reads, total_counts.io_writes, "0xFF{:02X}");
+    file.print("\n}}\n");
+    file.close();
+
+    LINFO("memory profiler: wrote {}", path.string());
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <filesystem>
+#include <fmt/os.h>
+#include <optional>
+#include "common/types.h"
+
+// Counts bus accesses per 256-byte page and per 0xFFxx register (I/O, HRAM and IE),
+// split by who made them. Only compiled in with HELIAGE_MEMORY_PROFILING.
+class MemoryProfiler {
+public:
+    enum class Source : u8 {
+        CPU,
+        DMA,
+        PPU,
+        // Interrupt bookkeeping, debuggers, etc.
+        Internal,
+        Count,
+    };
+
+    // Sets the source that accesses which don't come from the CPU are attributed to,
+    // and restores the previous one when it goes out of scope.
+    class SourceScope {
+    public:
+        SourceScope(MemoryProfiler& profiler, Source source)
+            : profiler(profiler), previous_source(profiler.internal_source) {
+            profiler.internal_source = source;
+        }
+
+        ~SourceScope() {
+            profiler.internal_source = previous_source;
+        }
+
+    private:
+        MemoryProfiler& profiler;
+        Source previous_source;
+    };
+
+    // Accesses made with cpu == false are attributed to the current SourceScope.
+    void RecordRead(u16 addr, bool cpu) { RecordRead(addr, cpu ? Source::CPU : internal_source); }
+    void RecordWrite(u16 addr, bool cpu) { RecordWrite(addr, cpu ? Source::CPU : internal_source); }
+    void RecordRead(u16 addr, Source source) { Record(frame_counts.reads, frame_counts.io_reads, addr, source); }
+    void RecordWrite(u16 addr, Source source) { Record(frame_counts.writes, frame_counts.io_writes, addr, source); }
+
+    // Starts appending one set of CSV rows per frame to the given file.
+    void SetFrameLog(const std::filesystem::path& path);
+    void EndFrame();
+
+    // Writes the counts for the whole run so far.
+    void ExportCSV(const std::filesystem::path& path);
+    void ExportJSON(const std::filesystem::path& path);
+
+private:
+    using Counters = std::array<std::array<u64, 0x100>, static_cast<size_t>(Source::Count)>;
+
+    struct Counts {
+        Counters reads {};
+        Counters writes {};
+        Counters io_reads {};
+        Counters io_writes {};
+    };
+
+    static void Record(Counters& page_counters, Counters& io_counters, u16 addr, Source source) {
+        const size_t index = static_cast<size_t>(source);
+        page_counters[index][addr >> 8]++;
+
+        if ((addr >> 8) == 0xFF) {
+            io_counters[index][addr & 0xFF]++;
+        }
+    }
+
+    void Accumulate();
+    void WriteCSVRows(fmt::ostream& file, const Counts& counts, std::optional<u64> frame);
+
+    Source internal_source = Source::Internal;
+
+    Counts frame_counts {};
+    Counts total_counts {};
+    u64 frames = 0;
+
+    std::optional<fmt::ostream> frame_log;
+};
+
+#ifdef HELIAGE_MEMORY_PROFILING
+#define PROFILE_ACCESS_SOURCE(profiler, source) MemoryProfiler::SourceScope profile_source_scope(profiler, MemoryProfiler::Source::source)
+#else
+#define PROFILE_ACCESS_SOURCE(profiler, source)
+#endif
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <cstring>
+#include "postprocess.h"
+
+// Source rows per strip. Enough strips for the workers to balance out, few enough that
+// handing them out doesn't cost more than the work.
+static constexpr u32 STRIP_ROWS = 16;
+
+u32 PostProcessor::GetDefaultWorkerCount() {
+    const u32 hardware_threads = std::max(std::thread::hardware_concurrency(), 2u);
+    return std::min(hardware_threads - 1, 3u);
+}
+
+PostProcessor::PostProcessor(u32 worker_count) {
+    for (u32 i = 0; i < worker_count; i++) {
+        workers.emplace_back(&PostProcessor::Worker, this);
+    }
+}
+
+PostProcessor::~PostProcessor() {
+    {
+        std::lock_guard lock(pool_mutex);
+        stopping = true;
+    }
+    job_cv.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void PostProcessor::Process(const PPU::RenderTarget& frame, PPU::PixelFormat format, const PPU::RenderTarget& output) {
+    // Blending with a frame in another format would mix up its channels.
+    if (format != ghost_format) {
+        ghost_valid = false;
+        ghost_format = format;
+    }
+
+    switch (PPU::GetBytesPerPixel(format)) {
+        case 4:
+            ProcessFrame<u32>(frame, output);
+            break;
+        case 2:
+            ProcessFrame<u16>(frame, output);
+            break;
+        default:
+            ProcessFrame<u8>(frame, output);
+            break;
+    }
+}
+
+template <typename Pixel>
+void PostProcessor::ProcessFrame(const PPU::RenderTarget& frame, const PPU::RenderTarget& output) {
+    constexpr u32 width = 160;
+    constexpr u32 height = 144;
+    constexpr u32 strips = (height + STRIP_ROWS - 1) / STRIP_ROWS;
+
+    // The ghost frame is the source for scaling even without ghosting, since the kernels need padded rows.
+    ghost_frame.Resize(width, height, sizeof(Pixel));
+    const bool blend = ghosting && ghost_valid;
+    const bool direct = (scaler == Scaler::None);
+
+    RunStrips(strips, [&](u32 strip) {
+        const u32 last_row = std::min((strip + 1) * STRIP_ROWS, height);
+        for (u32 y = strip * STRIP_ROWS; y < last_row; y++) {
+            const Pixel* row = reinterpret_cast<const Pixel*>(frame.pixels + y * frame.pitch);
+            Pixel* ghost = ghost_frame.GetRow<Pixel>(y);
+            if (blend) {
+                PostProcess::GhostRow(row, ghost, width);
+            } else {
+                std::memcpy(ghost, row, width * sizeof(Pixel));
+            }
+
+            if (direct) {
+                std::memcpy(output.pixels + y * output.pitch, ghost, width * sizeof(Pixel));
+            } else {
+                ghost_frame.PadRow<Pixel>(y, width);
+            }
+        }
+    });
+    ghost_valid = ghosting;
+
+    switch (scaler) {
+        case Scaler::None:
+            break;
+        case Scaler::Scale2x:
+        case Scaler::Scale3x:
+        case Scaler::XBR2x:
+            ScaleFrame<Pixel>(ghost_frame, width, height, scaler, output);
+            break;
+        case Scaler::Scale4x: {
+            intermediate_frame.Resize(width * 2, height * 2, sizeof(Pixel));
+            const PPU::RenderTarget intermediate { intermediate_frame.GetRow<u8>(0), intermediate_frame.pitch };
+            ScaleFrame<Pixel>(ghost_frame, width, height, Scaler::Scale2x, intermediate);
+            ScaleFrame<Pixel>(intermediate_frame, width * 2, height * 2, Scaler::Scale2x, output);
+            break;
+        }
+    }
+}
+
+template <typename Pixel>
+void PostProcessor::ScaleFrame(PaddedFrame& source, u32 width, u32 height, Scaler pass, const PPU::RenderTarget& output) {
+    // Scaling into the intermediate frame has to leave its rows padded for the next pass.
+    const bool pad_output = (output.pixels == intermediate_frame.GetRow<u8>(0));
+    const u32 scale = GetScale(pass);
+    // An xBR row takes many times as long as a Scale2x one, so it's worth handing xBR out in
+    // smaller strips to keep the threads from waiting on the last one.
+    const u32 strip_rows = (pass == Scaler::XBR2x) ? STRIP_ROWS / 4 : STRIP_ROWS;
+    const u32 strips = (height + strip_rows - 1) / strip_rows;
+
+    RunStrips(strips, [&](u32 strip) {
+        const u32 last_row = std::min((strip + 1) * strip_rows, height);
+        for (u32 y = strip * strip_rows; y < last_row; y++) {
+            const Pixel* above = source.GetRow<Pixel>(y == 0 ? 0 : y - 1);
+            const Pixel* row = source.GetRow<Pixel>(y);
+            const Pixel* below = source.GetRow<Pixel>(y == height - 1 ? y : y + 1);
+            Pixel* out[3] = {};
+            for (u32 i = 0; i < scale; i++) {
+                out[i] = reinterpret_cast<Pixel*>(output.pixels + (y * scale + i) * output.pitch);
+            }
+
+            switch (pass) {
+                case Scaler::Scale3x:
+                    PostProcess::Scale3xRow(above, row, below, width, out[0], out[1], out[2]);
+                    break;
+                case Scaler::XBR2x: {
+                    const Pixel* above2 = source.GetRow<Pixel>(y < 2 ? 0 : y - 2);
+                    const Pixel* below2 = source.GetRow<Pixel>(std::min(y + 2, height - 1));
+                    PostProcess::XBR2xRow(above2, above, row, below, below2, width, out[0], out[1]);
+                    break;
+                }
+                case Scaler::Scale2x:
+                default:
+                    PostProcess::Scale2xRow(above, row, below, width, out[0], out[1]);
+                    break;
+            }
+
+            if (pad_output) {
+                for (u32 i = 0; i < scale; i++) {
+                    intermediate_frame.PadRow<Pixel>(y * scale + i, width * scale);
+                }
+            }
+        }
+    });
+}
+
+void PostProcessor::RunStrips(u32 count, const std::function<void(u32)>& new_job) {
+    {
+        std::lock_guard lock(pool_mutex);
+        job = &new_job;
+        job_generation++;
+        strip_count = count;
+        next_strip = 0;
+        strips_done = 0;
+    }
+    job_cv.notify_all();
+
+    u32 done_here = 0;
+    for (u32 strip = next_strip++; strip < count; strip = next_strip++) {
+        new_job(strip);
+        done_here++;
+    }
+
+    std::unique_lock lock(pool_mutex);
+    strips_done += done_here;
+    done_cv.wait(lock, [&] { return strips_done == count && busy_workers == 0; });
+    job = nullptr;
+}
+
+void PostProcessor::Worker() {
+    u64 seen_generation = 0;
+    std::unique_lock lock(pool_mutex);
+    while (true) {
+        job_cv.wait(lock, [&] { return stopping || (job && job_generation != seen_generation); });
+        if (stopping) {
+            return;
+        }
+
+        seen_generation = job_generation;
+        const std::function<void(u32)>& current_job = *job;
+        const u32 count = strip_count;
+        busy_workers++;
+        lock.unlock();
+
+        u32 done_here = 0;
+        for (u32 strip = next_strip++; strip < count; strip = next_strip++) {
+            current_job(strip);
+            done_here++;
+        }
+
+        lock.lock();
+        strips_done += done_here;
+        busy_workers--;
+        if (strips_done == count && busy_workers == 0) {
+            done_cv.notify_one();
+        }
+    }
+}
@@ -0,0 +1,793 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "common/types.h"
+#include "ppu.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Row kernels for the post-processor. Source rows are padded, so row[-2], row[-1], row[width]
+// and row[width + 1] repeat the pixels at the edges and the kernels never have to check for the
+// left and right edges. At the top and bottom of a frame, the nearest row in the frame is passed
+// for rows above or below it.
+namespace PostProcess {
+
+// Scale2x (AdvMAME2x): every pixel becomes 2x2, and a corner takes the color of the two
+// neighbors that meet there if they match, which rounds off staircase edges.
+template <typename Pixel>
+void Scale2xRowScalar(const Pixel* above, const Pixel* row, const Pixel* below, u32 width, Pixel* out0, Pixel* out1) {
+    for (u32 x = 0; x < width; x++) {
+        const Pixel* p = row + x;
+        const Pixel b = above[x];
+        const Pixel d = p[-1];
+        const Pixel e = p[0];
+        const Pixel f = p[1];
+        const Pixel h = below[x];
+
+        if (b != h && d != f) {
+            out0[x * 2] = (d == b) ? d : e;
+            out0[x * 2 + 1] = (b == f) ? f : e;
+            out1[x * 2] = (d == h) ? d : e;
+            out1[x * 2 + 1] = (h == f) ? f : e;
+        } else {
+            out0[x * 2] = out0[x * 2 + 1] = e;
+            out1[x * 2] = out1[x * 2 + 1] = e;
+        }
+    }
+}
+
+// Scale3x (AdvMAME3x): like Scale2x, but every pixel becomes 3x3 and the edge pixels between
+// the corners follow the diagonals as well.
+template <typename Pixel>
+void Scale3xRowScalar(const Pixel* above, const Pixel* row, const Pixel* below, u32 width, Pixel* out0, Pixel* out1, Pixel* out2) {
+    for (u32 x = 0; x < width; x++) {
+        const Pixel* up = above + x;
+        const Pixel* p = row + x;
+        const Pixel* down = below + x;
+        const Pixel a = up[-1], b = up[0], c = up[1];
+        const Pixel d = p[-1], e = p[0], f = p[1];
+        const Pixel g = down[-1], h = down[0], i = down[1];
+
+        Pixel* row0 = out0 + x * 3;
+        Pixel* row1 = out1 + x * 3;
+        Pixel* row2 = out2 + x * 3;
+        if (b != h && d != f) {
+            row0[0] = (d == b) ? d : e;
+            row0[1] = ((d == b && e != c) || (b == f && e != a)) ? b : e;
+            row0[2] = (b == f) ? f : e;
+            row1[0] = ((d == b && e != g) || (d == h && e != a)) ? d : e;
+            row1[1] = e;
+            row1[2] = ((b == f && e != i) || (h == f && e != c)) ? f : e;
+            row2[0] = (d == h) ? d : e;
+            row2[1] = ((d == h && e != i) || (h == f && e != g)) ? h : e;
+            row2[2] = (h == f) ? f : e;
+        } else {
+            row0[0] = row0[1] = row0[2] = e;
+            row1[0] = row1[1] = row1[2] = e;
+            row2[0] = row2[1] = row2[2] = e;
+        }
+    }
+}
+
+// LCD ghosting: every pixel ends up half way between the new frame and what was shown last
+// frame, like the slow response of the original LCD. `ghost` holds what was shown last frame
+// and gets the blended row. Rounds like _mm_avg_epu8, per channel.
+template <typename Pixel>
+Pixel BlendPixels(Pixel a, Pixel b) {
+    if constexpr (sizeof(Pixel) == 2) {
+        // RGB565: halve each channel, dropping its lowest bit, then add.
+        return static_cast<Pixel>(((a >> 1) & 0x7BEF) + ((b >> 1) & 0x7BEF));
+    } else {
+        // Every byte is its own channel.
+        constexpr Pixel low_bits = static_cast<Pixel>(0xFEFEFEFEu);
+        return static_cast<Pixel>((a | b) - ((a ^ b) & low_bits) / 2);
+    }
+}
+
+template <typename Pixel>
+void GhostRowScalar(const Pixel* row, Pixel* ghost, u32 width) {
+    for (u32 x = 0; x < width; x++) {
+        ghost[x] = BlendPixels(row[x], ghost[x]);
+    }
+}
+
+namespace Detail {
+
+// How different two colors look. The kernels don't know the channel order, so unlike xBR's YUV
+// distance this is just the sum of the channels' differences, on a 0-255 scale per channel.
+template <typename Pixel>
+u32 ColorDistance(Pixel a, Pixel b) {
+    if constexpr (sizeof(Pixel) == 4) {
+#if defined(__SSE2__)
+        return _mm_cvtsi128_si32(_mm_sad_epu8(_mm_cvtsi32_si128(a), _mm_cvtsi32_si128(b)));
+#else
+        u32 distance = 0;
+        for (u32 shift = 0; shift < 32; shift += 8) {
+            distance += std::abs(static_cast<int>((a >> shift) & 0xFF) - static_cast<int>((b >> shift) & 0xFF));
+        }
+        return distance;
+#endif
+    } else if constexpr (sizeof(Pixel) == 2) {
+        // RGB565
+        return std::abs(static_cast<int>(a >> 11) - static_cast<int>(b >> 11)) * 8 +
+               std::abs(static_cast<int>((a >> 5) & 0x3F) - static_cast<int>((b >> 5) & 0x3F)) * 4 +
+               std::abs(static_cast<int>(a & 0x1F) - static_cast<int>(b & 0x1F)) * 8;
+    } else {
+        return std::abs(static_cast<int>(a) - static_cast<int>(b));
+    }
+}
+
+#if defined(__SSE2__)
+// ColorDistance for four 4-byte pixels at once. The bytes' differences are added up in pairs,
+// then pairs of pairs.
+inline __m128i ColorDistances(__m128i a, __m128i b) {
+    const __m128i difference = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+    const __m128i pairs = _mm_add_epi16(_mm_and_si128(difference, _mm_set1_epi16(0x00FF)), _mm_srli_epi16(difference, 8));
+    return _mm_add_epi32(_mm_and_si128(pairs, _mm_set1_epi32(0xFFFF)), _mm_srli_epi32(pairs, 16));
+}
+#endif
+
+// Colors closer than this count as the same.
+static constexpr u32 SIMILAR_COLORS = 16;
+
+// Moves `from` some eighths of the way to `to`, a channel at a time. The channels are spread
+// out so that each one has room for the multiplication.
+template <typename Pixel>
+Pixel MixPixels(Pixel from, Pixel to, u32 eighths) {
+    const u32 keep = 8 - eighths;
+    if constexpr (sizeof(Pixel) == 4) {
+        const u32 even = ((from & 0x00FF00FF) * keep + (to & 0x00FF00FF) * eighths) >> 3;
+        const u32 odd = (((from >> 8) & 0x00FF00FF) * keep + ((to >> 8) & 0x00FF00FF) * eighths) >> 3;
+        return (even & 0x00FF00FF) | (odd & 0x00FF00FF) << 8;
+    } else if constexpr (sizeof(Pixel) == 2) {
+        // RGB565: red and blue are far enough apart to do together.
+        const u32 red_blue = ((from & 0xF81F) * keep + (to & 0xF81F) * eighths) >> 3;
+        const u32 green = ((from & 0x07E0) * keep + (to & 0x07E0) * eighths) >> 3;
+        return static_cast<Pixel>((red_blue & 0xF81F) | (green & 0x07E0));
+    } else {
+        return static_cast<Pixel>((from * keep + to * eighths) >> 3);
+    }
+}
+
+// xBR looks at a lot of diagonal neighbors, and each pair of them takes part in several corners
+// of several pixels, so their distances are worked out once per chunk of a row. Rows 0-4 are
+// the two rows above, the row itself and the two rows below. down_right[k][c] is the distance
+// from column c of row k to column c + 1 of row k + 1, and up_right[k][c] from column c of row
+// k + 1 to column c + 1 of row k. Columns count from two left of the chunk. Distances are at
+// most 1020, so they're kept in 16 bits, which lets the SIMD kernel work on eight at a time.
+static constexpr u32 XBR_CHUNK = 64;
+
+struct XBRDistances {
+    u16 down_right[4][XBR_CHUNK + 3];
+    u16 up_right[4][XBR_CHUNK + 3];
+};
+
+// Fills in the distances for `count` pixels from column `first`, plus the three extra columns.
+template <typename Pixel>
+void ComputeXBRDistances(const Pixel* const (&rows)[5], u32 first, u32 count, XBRDistances& distances) {
+    for (u32 k = 0; k < 4; k++) {
+        const Pixel* upper = rows[k] + first;
+        const Pixel* lower = rows[k + 1] + first;
+        int column = 0;
+#if defined(__SSE2__)
+        if constexpr (sizeof(Pixel) == 4) {
+            const auto distance = [](const Pixel* a, const Pixel* b) {
+                const auto load = [](const Pixel* pixels) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels)); };
+                return _mm_packs_epi32(ColorDistances(load(a), load(b)), ColorDistances(load(a + 4), load(b + 4)));
+            };
+            for (; column + 8 <= static_cast<int>(count) + 3; column += 8) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(&distances.down_right[k][column]), distance(upper + column - 2, lower + column - 1));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(&distances.up_right[k][column]), distance(lower + column - 2, upper + column - 1));
+            }
+        }
+#endif
+        for (; column < static_cast<int>(count) + 3; column++) {
+            distances.down_right[k][column] = ColorDistance(upper[column - 2], lower[column - 1]);
+            distances.up_right[k][column] = ColorDistance(lower[column - 2], upper[column - 1]);
+        }
+    }
+}
+
+// A pixel around e, in rows below and columns right of it.
+struct XBRPosition {
+    int row;
+    int col;
+};
+
+// Turns a position a quarter turn counterclockwise around e, `turns` times.
+constexpr XBRPosition TurnPosition(XBRPosition position, int turns) {
+    for (int turn = 0; turn < turns; turn++) {
+        position = { -position.col, position.row };
+    }
+    return position;
+}
+
+// Which of the four output pixels (top left, top right, bottom left, bottom right) a corner is.
+constexpr u32 GetQuadrant(XBRPosition position) {
+    return (position.row > 0 ? 2 : 0) + (position.col > 0 ? 1 : 0);
+}
+
+// One corner of xBR 2x. Turns is how far the neighborhood is turned for the corner to be the
+// bottom right one, which is what the names are for:
+//
+//        b  c
+//     d  e  f  f4
+//     g  h  i  i4
+//        h5 i5
+//
+// The output pixels next to the corner on h's and f's side can be blended too.
+template <int Turns, typename Pixel>
+void XBRCorner(const Pixel* const (&rows)[5], const XBRDistances& distances, u32 x, u32 column, Pixel (&out)[4]) {
+    constexpr XBRPosition B = TurnPosition({ -1, 0 }, Turns), C = TurnPosition({ -1, 1 }, Turns);
+    constexpr XBRPosition D = TurnPosition({ 0, -1 }, Turns), E = { 0, 0 }, F = TurnPosition({ 0, 1 }, Turns);
+    constexpr XBRPosition G = TurnPosition({ 1, -1 }, Turns), H = TurnPosition({ 1, 0 }, Turns), I = TurnPosition({ 1, 1 }, Turns);
+    constexpr XBRPosition F4 = TurnPosition({ 0, 2 }, Turns), I4 = TurnPosition({ 1, 2 }, Turns);
+    constexpr XBRPosition H5 = TurnPosition({ 2, 0 }, Turns), I5 = TurnPosition({ 2, 1 }, Turns);
+    constexpr u32 corner = GetQuadrant(I);
+    constexpr u32 along_h = GetQuadrant(TurnPosition({ 1, -1 }, Turns));
+    constexpr u32 along_f = GetQuadrant(TurnPosition({ -1, 1 }, Turns));
+
+    const auto pixel = [&](XBRPosition p) { return (rows[p.row + 2] + x)[p.col]; };
+    const auto distance = [&](XBRPosition p, XBRPosition q) {
+        const XBRPosition upper = (p.row < q.row) ? p : q;
+        const XBRPosition lower = (p.row < q.row) ? q : p;
+        return (lower.col > upper.col) ? distances.down_right[upper.row + 2][column + upper.col + 2]
+                                       : distances.up_right[upper.row + 2][column + lower.col + 2];
+    };
+
+    const Pixel e = pixel(E), f = pixel(F), h = pixel(H);
+    if (e == h || e == f) {
+        return;
+    }
+
+    // An edge runs between e and i if colors change less along it than across it.
+    const u32 ec = distance(E, C), eg = distance(E, G), ei = distance(E, I);
+    const u32 fb = distance(F, B), fi4 = distance(F, I4), hd = distance(H, D), hi5 = distance(H, I5);
+    const u32 across = ec + eg + distance(I, H5) + distance(I, F4) + distance(H, F) * 4;
+    const u32 along = hd + hi5 + fi4 + fb + ei * 4;
+    if (across > along) {
+        return;
+    }
+
+    const Pixel color = (ColorDistance(e, f) <= ColorDistance(e, h)) ? f : h;
+    const bool clear_edge = (across != along) &
+                            ((fb >= SIMILAR_COLORS && hd >= SIMILAR_COLORS) ||
+                             (ei < SIMILAR_COLORS && fi4 >= SIMILAR_COLORS && hi5 >= SIMILAR_COLORS) ||
+                             eg < SIMILAR_COLORS || ec < SIMILAR_COLORS);
+
+    // Clear shallow and steep edges reach into the pixels next to the corner. Which kind of edge
+    // it is only changes how far pixels are mixed, so it's worked out without branching, which
+    // wouldn't be predictable.
+    const Pixel b = pixel(B), c = pixel(C), d = pixel(D), g = pixel(G);
+    const u32 fg = ColorDistance(f, g);
+    const u32 hc = ColorDistance(h, c);
+    const bool shallow = clear_edge & (fg * 2 <= hc) & (e != g) & (d != g);
+    const bool steep = clear_edge & (fg >= hc * 2) & (e != c) & (b != c);
+    const u32 corner_eighths = 4 + (shallow | steep) * 2 + (shallow & steep);
+    const Pixel mixed_h = MixPixels(out[along_h], color, shallow * 2);
+    const Pixel mixed_f = MixPixels(out[along_f], color, steep * 2);
+
+    out[corner] = MixPixels(out[corner], color, corner_eighths);
+    out[along_h] = mixed_h;
+    out[along_f] = (shallow & steep) ? mixed_h : mixed_f;
+}
+
+}
+
+// xBR 2x (after Hyllian's 2xBR): every pixel becomes 2x2, and corners that an edge cuts through
+// are blended towards the color on the other side of it. Edges are found by comparing color
+// distances along and across them over a 5x5 neighborhood, so unlike Scale2x, shallow and steep
+// slopes come out smooth as well as 45 degree ones.
+template <typename Pixel>
+void XBR2xRowScalar(const Pixel* above2, const Pixel* above, const Pixel* row, const Pixel* below, const Pixel* below2,
+                    u32 width, Pixel* out0, Pixel* out1) {
+    using namespace Detail;
+    const Pixel* const rows[5] = { above2, above, row, below, below2 };
+    XBRDistances distances;
+
+    for (u32 first = 0; first < width; first += XBR_CHUNK) {
+        const u32 count = std::min(XBR_CHUNK, width - first);
+        ComputeXBRDistances(rows, first, count, distances);
+
+        for (u32 column = 0; column < count; column++) {
+            const u32 x = first + column;
+            Pixel out[4] = { row[x], row[x], row[x], row[x] };
+            XBRCorner<0>(rows, distances, x, column, out);
+            XBRCorner<1>(rows, distances, x, column, out);
+            XBRCorner<2>(rows, distances, x, column, out);
+            XBRCorner<3>(rows, distances, x, column, out);
+
+            out0[x * 2] = out[0];
+            out0[x * 2 + 1] = out[1];
+            out1[x * 2] = out[2];
+            out1[x * 2 + 1] = out[3];
+        }
+    }
+}
+
+#if defined(__SSE2__)
+namespace Detail {
+
+template <typename Pixel>
+__m128i CompareEqual(__m128i a, __m128i b) {
+    if constexpr (sizeof(Pixel) == 4) {
+        return _mm_cmpeq_epi32(a, b);
+    } else if constexpr (sizeof(Pixel) == 2) {
+        return _mm_cmpeq_epi16(a, b);
+    } else {
+        return _mm_cmpeq_epi8(a, b);
+    }
+}
+
+inline __m128i Select(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+inline __m128i Load(const void* pixels) {
+    return _mm_loadu_si128(static_cast<const __m128i*>(pixels));
+}
+
+// Writes a0 b0 a1 b1 ..., two vectors' worth of pixels.
+template <typename Pixel>
+void StoreInterleaved(Pixel* out, __m128i a, __m128i b) {
+    __m128i low, high;
+    if constexpr (sizeof(Pixel) == 4) {
+        low = _mm_unpacklo_epi32(a, b);
+        high = _mm_unpackhi_epi32(a, b);
+    } else if constexpr (sizeof(Pixel) == 2) {
+        low = _mm_unpacklo_epi16(a, b);
+        high = _mm_unpackhi_epi16(a, b);
+    } else {
+        low = _mm_unpacklo_epi8(a, b);
+        high = _mm_unpackhi_epi8(a, b);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), low);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out) + 1, high);
+}
+
+// MixPixels for four 4-byte pixels, each with its own number of eighths. The channels are
+// widened to 16 bits, so `weights` has each pixel's eighths in both of its 16-bit halves, to be
+// copied to its four channels.
+inline __m128i MixPixels(__m128i from, __m128i to, __m128i weights) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i eight = _mm_set1_epi16(8);
+    const __m128i channel_weights[2] = { _mm_unpacklo_epi32(weights, weights), _mm_unpackhi_epi32(weights, weights) };
+    const __m128i froms[2] = { _mm_unpacklo_epi8(from, zero), _mm_unpackhi_epi8(from, zero) };
+    const __m128i tos[2] = { _mm_unpacklo_epi8(to, zero), _mm_unpackhi_epi8(to, zero) };
+
+    __m128i mixed[2];
+    for (u32 half = 0; half < 2; half++) {
+        const __m128i sum = _mm_add_epi16(_mm_mullo_epi16(froms[half], _mm_sub_epi16(eight, channel_weights[half])),
+                                          _mm_mullo_epi16(tos[half], channel_weights[half]));
+        mixed[half] = _mm_srli_epi16(sum, 3);
+    }
+    return _mm_packus_epi16(mixed[0], mixed[1]);
+}
+
+// Eight 4-byte pixels, which take two vectors.
+struct XBRPixels {
+    __m128i halves[2];
+
+    const __m128i& operator[](u32 half) const { return halves[half]; }
+};
+
+// Which of e's distances to its right, lower, left and upper neighbors a position is.
+constexpr u32 GetNeighborIndex(XBRPosition position) {
+    return (position.col > 0) ? 0 : (position.row > 0) ? 1 : (position.col < 0) ? 2 : 3;
+}
+
+// XBRCorner for eight 4-byte pixels from x on. The same rules become masks, and lanes that don't
+// have a corner to blend are mixed by zero eighths, which leaves them as they are. Distances and
+// masks have a 16-bit lane per pixel, while pixels take two vectors, so masks are narrowed and
+// widened between the two. Every corner uses e's distances to two of its neighbors, so those
+// are worked out once for all four.
+template <int Turns>
+void XBRCorner(const u32* const (&rows)[5], const XBRDistances& distances, const __m128i (&neighbor_distances)[4],
+               u32 x, u32 column, __m128i (&out)[4][2]) {
+    constexpr XBRPosition B = TurnPosition({ -1, 0 }, Turns), C = TurnPosition({ -1, 1 }, Turns);
+    constexpr XBRPosition D = TurnPosition({ 0, -1 }, Turns), E = { 0, 0 }, F = TurnPosition({ 0, 1 }, Turns);
+    constexpr XBRPosition G = TurnPosition({ 1, -1 }, Turns), H = TurnPosition({ 1, 0 }, Turns), I = TurnPosition({ 1, 1 }, Turns);
+    constexpr XBRPosition F4 = TurnPosition({ 0, 2 }, Turns), I4 = TurnPosition({ 1, 2 }, Turns);
+    constexpr XBRPosition H5 = TurnPosition({ 2, 0 }, Turns), I5 = TurnPosition({ 2, 1 }, Turns);
+    constexpr u32 corner = GetQuadrant(I);
+    constexpr u32 along_h = GetQuadrant(TurnPosition({ 1, -1 }, Turns));
+    constexpr u32 along_f = GetQuadrant(TurnPosition({ -1, 1 }, Turns));
+
+    const auto pixel = [&](XBRPosition p) {
+        const u32* pixels = rows[p.row + 2] + x + p.col;
+        return XBRPixels { { Load(pixels), Load(pixels + 4) } };
+    };
+    const auto distance = [&](XBRPosition p, XBRPosition q) {
+        const XBRPosition upper = (p.row < q.row) ? p : q;
+        const XBRPosition lower = (p.row < q.row) ? q : p;
+        return (lower.col > upper.col) ? Load(&distances.down_right[upper.row + 2][column + upper.col + 2])
+                                       : Load(&distances.up_right[upper.row + 2][column + lower.col + 2]);
+    };
+    const auto equal = [](const XBRPixels& a, const XBRPixels& b) {
+        return _mm_packs_epi32(_mm_cmpeq_epi32(a[0], b[0]), _mm_cmpeq_epi32(a[1], b[1]));
+    };
+    const auto widen = [](__m128i mask, u32 half) { return half ? _mm_unpackhi_epi16(mask, mask) : _mm_unpacklo_epi16(mask, mask); };
+    const __m128i similar = _mm_set1_epi16(SIMILAR_COLORS);
+    const auto is_similar = [&](__m128i value) { return _mm_cmplt_epi16(value, similar); };
+    const __m128i ones = _mm_set1_epi32(-1);
+
+    const XBRPixels e = pixel(E), f = pixel(F), h = pixel(H);
+    const __m128i ec = distance(E, C), eg = distance(E, G), ei = distance(E, I);
+    const __m128i fb = distance(F, B), fi4 = distance(F, I4), hd = distance(H, D), hi5 = distance(H, I5);
+    const __m128i across = _mm_add_epi16(_mm_add_epi16(_mm_add_epi16(ec, eg), _mm_add_epi16(distance(I, H5), distance(I, F4))),
+                                         _mm_slli_epi16(distance(H, F), 2));
+    const __m128i along = _mm_add_epi16(_mm_add_epi16(_mm_add_epi16(hd, hi5), _mm_add_epi16(fi4, fb)), _mm_slli_epi16(ei, 2));
+    const __m128i flat = _mm_or_si128(equal(e, h), equal(e, f));
+    const __m128i edge = _mm_andnot_si128(_mm_or_si128(flat, _mm_cmpgt_epi16(across, along)), ones);
+    if (_mm_movemask_epi8(edge) == 0) {
+        return;
+    }
+
+    const __m128i ef = neighbor_distances[GetNeighborIndex(F)];
+    const __m128i eh = neighbor_distances[GetNeighborIndex(H)];
+    const __m128i take_h = _mm_cmpgt_epi16(ef, eh);
+    const XBRPixels color = { { Select(widen(take_h, 0), h[0], f[0]), Select(widen(take_h, 1), h[1], f[1]) } };
+    const __m128i some_clear = _mm_or_si128(
+        _mm_or_si128(_mm_andnot_si128(_mm_or_si128(is_similar(fb), is_similar(hd)), ones),
+                     _mm_andnot_si128(_mm_or_si128(is_similar(fi4), is_similar(hi5)), is_similar(ei))),
+        _mm_or_si128(is_similar(eg), is_similar(ec)));
+    const __m128i clear_edge = _mm_and_si128(_mm_and_si128(edge, _mm_cmplt_epi16(across, along)), some_clear);
+    if (_mm_movemask_epi8(clear_edge) == 0) {
+        const __m128i corner_eighths = _mm_and_si128(edge, _mm_set1_epi16(4));
+        for (u32 half = 0; half < 2; half++) {
+            out[corner][half] = MixPixels(out[corner][half], color[half], widen(corner_eighths, half));
+        }
+        return;
+    }
+
+    const XBRPixels b = pixel(B), c = pixel(C), d = pixel(D), g = pixel(G);
+    const __m128i fg = _mm_packs_epi32(ColorDistances(f[0], g[0]), ColorDistances(f[1], g[1]));
+    const __m128i hc = _mm_packs_epi32(ColorDistances(h[0], c[0]), ColorDistances(h[1], c[1]));
+    const __m128i shallow = _mm_andnot_si128(
+        _mm_or_si128(_mm_cmpgt_epi16(_mm_slli_epi16(fg, 1), hc), _mm_or_si128(equal(e, g), equal(d, g))), clear_edge);
+    const __m128i steep = _mm_andnot_si128(
+        _mm_or_si128(_mm_cmplt_epi16(fg, _mm_slli_epi16(hc, 1)), _mm_or_si128(equal(e, c), equal(b, c))), clear_edge);
+    const __m128i both = _mm_and_si128(shallow, steep);
+    const __m128i corner_eighths = _mm_or_si128(_mm_and_si128(edge, _mm_set1_epi16(4)),
+                                                _mm_or_si128(_mm_and_si128(_mm_or_si128(shallow, steep), _mm_set1_epi16(2)),
+                                                             _mm_and_si128(both, _mm_set1_epi16(1))));
+    const __m128i h_eighths = _mm_and_si128(shallow, _mm_set1_epi16(2));
+    const __m128i f_eighths = _mm_and_si128(steep, _mm_set1_epi16(2));
+
+    for (u32 half = 0; half < 2; half++) {
+        const __m128i mixed_h = MixPixels(out[along_h][half], color[half], widen(h_eighths, half));
+        const __m128i mixed_f = MixPixels(out[along_f][half], color[half], widen(f_eighths, half));
+        out[corner][half] = MixPixels(out[corner][half], color[half], widen(corner_eighths, half));
+        out[along_h][half] = mixed_h;
+        out[along_f][half] = Select(widen(both, half), mixed_h, mixed_f);
+    }
+}
+
+}
+
+// Like Scale2xRowScalar, a vector of pixels at a time. width must be a multiple of 16 bytes' worth of pixels.
+template <typename Pixel>
+void Scale2xRowSSE2(const Pixel* above, const Pixel* row, const Pixel* below, u32 width, Pixel* out0, Pixel* out1) {
+    using namespace Detail;
+    constexpr u32 lanes = 16 / sizeof(Pixel);
+    const __m128i ones = _mm_set1_epi32(-1);
+
+    for (u32 x = 0; x < width; x += lanes) {
+        const __m128i b = Load(above + x);
+        const __m128i d = Load(row + x - 1);
+        const __m128i e = Load(row + x);
+        const __m128i f = Load(row + x + 1);
+        const __m128i h = Load(below + x);
+
+        const __m128i corners = _mm_andnot_si128(_mm_or_si128(CompareEqual<Pixel>(b, h), CompareEqual<Pixel>(d, f)), ones);
+        const __m128i e0 = Select(_mm_and_si128(corners, CompareEqual<Pixel>(d, b)), d, e);
+        const __m128i e1 = Select(_mm_and_si128(corners, CompareEqual<Pixel>(b, f)), f, e);
+        const __m128i e2 = Select(_mm_and_si128(corners, CompareEqual<Pixel>(d, h)), d, e);
+        const __m128i e3 = Select(_mm_and_si128(corners, CompareEqual<Pixel>(h, f)), f, e);
+
+        StoreInterleaved<Pixel>(out0 + x * 2, e0, e1);
+        StoreInterleaved<Pixel>(out1 + x * 2, e2, e3);
+    }
+}
+
+// Like Scale3xRowScalar, a vector of pixels at a time. The rules are evaluated with SIMD, and
+// the three pixels per source pixel are spread out to the output rows afterwards.
+template <typename Pixel>
+void Scale3xRowSSE2(const Pixel* above, const Pixel* row, const Pixel* below, u32 width, Pixel* out0, Pixel* out1, Pixel* out2) {
+    using namespace Detail;
+    constexpr u32 lanes = 16 / sizeof(Pixel);
+    const __m128i ones = _mm_set1_epi32(-1);
+    alignas(16) Pixel results[9][lanes];
+
+    for (u32 x = 0; x < width; x += lanes) {
+        const __m128i a = Load(above + x - 1);
+        const __m128i b = Load(above + x);
+        const __m128i c = Load(above + x + 1);
+        const __m128i d = Load(row + x - 1);
+        const __m128i e = Load(row + x);
+        const __m128i f = Load(row + x + 1);
+        const __m128i g = Load(below + x - 1);
+        const __m128i h = Load(below + x);
+        const __m128i i = Load(below + x + 1);
+
+        const __m128i corners = _mm_andnot_si128(_mm_or_si128(CompareEqual<Pixel>(b, h), CompareEqual<Pixel>(d, f)), ones);
+        const __m128i db = _mm_and_si128(corners, CompareEqual<Pixel>(d, b));
+        const __m128i bf = _mm_and_si128(corners, CompareEqual<Pixel>(b, f));
+        const __m128i dh = _mm_and_si128(corners, CompareEqual<Pixel>(d, h));
+        const __m128i hf = _mm_and_si128(corners, CompareEqual<Pixel>(h, f));
+        const __m128i ea = CompareEqual<Pixel>(e, a);
+        const __m128i ec = CompareEqual<Pixel>(e, c);
+        const __m128i eg = CompareEqual<Pixel>(e, g);
+        const __m128i ei = CompareEqual<Pixel>(e, i);
+
+        const __m128i outputs[9] = {
+            Select(db, d, e),
+            Select(_mm_or_si128(_mm_andnot_si128(ec, db), _mm_andnot_si128(ea, bf)), b, e),
+            Select(bf, f, e),
+            Select(_mm_or_si128(_mm_andnot_si128(eg, db), _mm_andnot_si128(ea, dh)), d, e),
+            e,
+            Select(_mm_or_si128(_mm_andnot_si128(ei, bf), _mm_andnot_si128(ec, hf)), f, e),
+            Select(dh, d, e),
+            Select(_mm_or_si128(_mm_andnot_si128(ei, dh), _mm_andnot_si128(eg, hf)), h, e),
+            Select(hf, f, e),
+        };
+        for (u32 j = 0; j < 9; j++) {
+            _mm_store_si128(reinterpret_cast<__m128i*>(results[j]), outputs[j]);
+        }
+
+        Pixel* rows[3] = { out0 + x * 3, out1 + x * 3, out2 + x * 3 };
+        for (u32 r = 0; r < 3; r++) {
+            for (u32 lane = 0; lane < lanes; lane++) {
+                rows[r][lane * 3] = results[r * 3][lane];
+                rows[r][lane * 3 + 1] = results[r * 3 + 1][lane];
+                rows[r][lane * 3 + 2] = results[r * 3 + 2][lane];
+            }
+        }
+    }
+}
+
+// Like GhostRowScalar, a vector of pixels at a time.
+template <typename Pixel>
+void GhostRowSSE2(const Pixel* row, Pixel* ghost, u32 width) {
+    using namespace Detail;
+    constexpr u32 lanes = 16 / sizeof(Pixel);
+    const __m128i channel_mask = _mm_set1_epi16(0x7BEF);
+
+    for (u32 x = 0; x < width; x += lanes) {
+        const __m128i a = Load(row + x);
+        const __m128i b = Load(ghost + x);
+        __m128i blended;
+        if constexpr (sizeof(Pixel) == 2) {
+            blended = _mm_add_epi16(_mm_and_si128(_mm_srli_epi16(a, 1), channel_mask),
+                                    _mm_and_si128(_mm_srli_epi16(b, 1), channel_mask));
+        } else {
+            blended = _mm_avg_epu8(a, b);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(ghost + x), blended);
+    }
+}
+
+// Like XBR2xRowScalar, eight 4-byte pixels at a time. width must be a multiple of 8.
+template <typename Pixel>
+void XBR2xRowSSE2(const Pixel* above2, const Pixel* above, const Pixel* row, const Pixel* below, const Pixel* below2,
+                  u32 width, Pixel* out0, Pixel* out1) {
+    static_assert(sizeof(Pixel) == 4, "the SSE2 xBR kernel only handles 4-byte pixels");
+    using namespace Detail;
+    const Pixel* const rows[5] = { above2, above, row, below, below2 };
+    XBRDistances distances;
+
+    for (u32 first = 0; first < width; first += XBR_CHUNK) {
+        const u32 count = std::min(XBR_CHUNK, width - first);
+        ComputeXBRDistances(rows, first, count, distances);
+
+        for (u32 column = 0; column < count; column += 8) {
+            const u32 x = first + column;
+            const __m128i e[2] = { Load(row + x), Load(row + x + 4) };
+            const auto neighbor_distance = [&](const Pixel* neighbors) {
+                return _mm_packs_epi32(ColorDistances(e[0], Load(neighbors)), ColorDistances(e[1], Load(neighbors + 4)));
+            };
+            const __m128i neighbor_distances[4] = {
+                neighbor_distance(row + x + 1),
+                neighbor_distance(below + x),
+                neighbor_distance(row + x - 1),
+                neighbor_distance(above + x),
+            };
+            __m128i out[4][2] = { { e[0], e[1] }, { e[0], e[1] }, { e[0], e[1] }, { e[0], e[1] } };
+            XBRCorner<0>(rows, distances, neighbor_distances, x, column, out);
+            XBRCorner<1>(rows, distances, neighbor_distances, x, column, out);
+            XBRCorner<2>(rows, distances, neighbor_distances, x, column, out);
+            XBRCorner<3>(rows, distances, neighbor_distances, x, column, out);
+
+            for (u32 half = 0; half < 2; half++) {
+                StoreInterleaved<Pixel>(out0 + (x + half * 4) * 2, out[0][half], out[1][half]);
+                StoreInterleaved<Pixel>(out1 + (x + half * 4) * 2, out[2][half], out[3][half]);
+            }
+        }
+    }
+}
+#endif
+
+template <typename Pixel>
+void Scale2xRow(const Pixel* above, const Pixel* row, const Pixel* below, u32 width, Pixel* out0, Pixel* out1) {
+#if defined(__SSE2__)
+    Scale2xRowSSE2(above, row, below, width, out0, out1);
+#else
+    Scale2xRowScalar(above, row, below, width, out0, out1);
+#endif
+}
+
+template <typename Pixel>
+void Scale3xRow(const Pixel* above, const Pixel* row, const Pixel* below, u32 width, Pixel* out0, Pixel* out1, Pixel* out2) {
+#if defined(__SSE2__)
+    Scale3xRowSSE2(above, row, below, width, out0, out1, out2);
+#else
+    Scale3xRowScalar(above, row, below, width, out0, out1, out2);
+#endif
+}
+
+template <typename Pixel>
+void GhostRow(const Pixel* row, Pixel* ghost, u32 width) {
+#if defined(__SSE2__)
+    GhostRowSSE2(row, ghost, width);
+#else
+    GhostRowScalar(row, ghost, width);
+#endif
+}
+
+// The SIMD version only handles 4-byte pixels, the color distances of the others don't map
+// onto byte arithmetic.
+template <typename Pixel>
+void XBR2xRow(const Pixel* above2, const Pixel* above, const Pixel* row, const Pixel* below, const Pixel* below2,
+              u32 width, Pixel* out0, Pixel* out1) {
+#if defined(__SSE2__)
+    if constexpr (sizeof(Pixel) == 4) {
+        XBR2xRowSSE2(above2, above, row, below, below2, width, out0, out1);
+        return;
+    }
+#endif
+    XBR2xRowScalar(above2, above, row, below, below2, width, out0, out1);
+}
+
+}
+
+// A stage between the PPU and the frontend that post-processes finished frames: LCD ghosting,
+// then upscaling with Scale2x, Scale3x, Scale4x (Scale2x twice), or xBR 2x.
+// Each pass is split into strips of rows, worked on by a small thread pool and the thread
+// calling Process.
+class PostProcessor {
+public:
+    enum class Scaler {
+        None,
+        Scale2x,
+        Scale3x,
+        Scale4x,
+        XBR2x,
+    };
+    static constexpr u32 SCALER_COUNT = 5;
+
+    static constexpr u32 GetScale(Scaler scaler) {
+        switch (scaler) {
+            case Scaler::Scale2x:
+            case Scaler::XBR2x:
+                return 2;
+            case Scaler::Scale3x:
+                return 3;
+            case Scaler::Scale4x:
+                return 4;
+            case Scaler::None:
+            default:
+                return 1;
+        }
+    }
+
+    static constexpr const char* GetName(Scaler scaler) {
+        switch (scaler) {
+            case Scaler::Scale2x:
+                return "Scale2x";
+            case Scaler::Scale3x:
+                return "Scale3x";
+            case Scaler::Scale4x:
+                return "Scale4x";
+            case Scaler::XBR2x:
+                return "xBR 2x";
+            case Scaler::None:
+            default:
+                return "none";
+        }
+    }
+
+    // Up to 3 workers, leaving a core for the emulator.
+    static u32 GetDefaultWorkerCount();
+
+    explicit PostProcessor(u32 worker_count = GetDefaultWorkerCount());
+    ~PostProcessor();
+
+    PostProcessor(const PostProcessor&) = delete;
+    PostProcessor& operator=(const PostProcessor&) = delete;
+
+    Scaler GetScaler() const { return scaler; }
+    void SetScaler(Scaler new_scaler) { scaler = new_scaler; }
+    u32 GetScale() const { return GetScale(scaler); }
+
+    bool IsGhostingEnabled() const { return ghosting; }
+    void SetGhostingEnabled(bool enabled) {
+        ghosting = enabled;
+        ghost_valid = false;
+    }
+
+    bool IsEnabled() const { return scaler != Scaler::None || ghosting; }
+
+    // Processes a finished 160x144 frame into `output`, which has to hold 160x144 pixels times the
+    // scale in each direction. Must be called from one thread at a time.
+    void Process(const PPU::RenderTarget& frame, PPU::PixelFormat format, const PPU::RenderTarget& output);
+
+private:
+    // A frame with two pixels of slack on either side of every row (see PostProcess).
+    struct PaddedFrame {
+        // Keeps the rows 16-byte aligned.
+        static constexpr u32 PADDING = 16;
+
+        std::vector<u8> data;
+        u32 pitch = 0;
+
+        void Resize(u32 width, u32 height, u32 bytes_per_pixel) {
+            pitch = PADDING + width * bytes_per_pixel + PADDING;
+            data.resize(pitch * height + PADDING);
+        }
+
+        template <typename Pixel>
+        Pixel* GetRow(u32 y) { return reinterpret_cast<Pixel*>(data.data() + y * pitch + PADDING); }
+
+        // Repeats the edge pixels of a row into the slack.
+        template <typename Pixel>
+        void PadRow(u32 y, u32 width) {
+            Pixel* row = GetRow<Pixel>(y);
+            row[-2] = row[-1] = row[0];
+            row[width + 1] = row[width] = row[width - 1];
+        }
+    };
+
+    template <typename Pixel>
+    void ProcessFrame(const PPU::RenderTarget& frame, const PPU::RenderTarget& output);
+    template <typename Pixel>
+    void ScaleFrame(PaddedFrame& source, u32 width, u32 height, Scaler pass, const PPU::RenderTarget& output);
+
+    // Runs job(strip) for every strip in [0, count), spread across the workers and this thread,
+    // and returns once they're all done.
+    void RunStrips(u32 count, const std::function<void(u32)>& job);
+    void Worker();
+
+    Scaler scaler = Scaler::None;
+    bool ghosting = false;
+
+    // The frame as it was last shown, with ghosting applied, in the last frame's format.
+    PaddedFrame ghost_frame;
+    PPU::PixelFormat ghost_format = PPU::PixelFormat::ARGB8888;
+    bool ghost_valid = false;
+    // The Scale2x output Scale4x runs Scale2x on again.
+    PaddedFrame intermediate_frame;
+
+    std::vector<std::thread> workers;
+    std::mutex pool_mutex;
+    // Signalled when there's a new job, or the workers should stop.
+    std::condition_variable job_cv;
+    // Signalled when a worker is done with a job.
+    std::condition_variable done_cv;
+    const std::function<void(u32)>* job = nullptr;
+    u64 job_generation = 0;
+    u32 strip_count = 0;
+    std::atomic<u32> next_strip = 0;
+    u32 strips_done = 0;
+    // Workers still working on the current job. A job isn't over until they've all left it.
+    u32 busy_workers = 0;
+    bool stopping = false;
+};
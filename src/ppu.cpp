@@ -1,15 +1,37 @@
+#include <algorithm>
+#include <bit>
 #include <cmath>
+#include <cstring>
 #include "bus.h"
+#include "debug_views.h"
+#include "frame_exporter.h"
 #include "logging.h"
 #include "ppu.h"
+#include "scanline.h"
 #include "frontend/frontend.h"
 
-#define HELIAGE_USE_PIXEL_FIFO 0
-
 static constexpr u32 TemporaryCycleAdjustment = 30; // No more than 117
 
 PPU::PPU(Bus& bus)
-    : bus(bus) {
+    : bus(bus), vram(bus.GetVRAM()), oam(bus.GetOAM()),
+      hardware_mode(bus.IsCGB() ? HardwareMode::CGB : HardwareMode::DMG) {
+    for (BackgroundPlane& plane : bg_planes) {
+        plane.indices.resize(256 * 256);
+    }
+    InvalidateBackgroundPlanes();
+
+    bg_color_palettes.data.fill(0xFF);
+    obj_color_palettes.data.fill(0xFF);
+
+    SetPixelFormat(pixel_format);
+
+#ifdef HELIAGE_FRAME_HASH_LOG
+    SetFrameHashLog("frame_hashes.csv");
+#endif
+}
+
+PPU::~PPU() {
+    StopLineWorker();
 }
 
 void PPU::AdvanceCycles(u64 cycles) {
@@ -29,14 +51,46 @@ void PPU::CheckForLYCoincidence() {
     stat |= 0x4;
     if (stat & (1 << 6) && !lyc_interrupt_fired) {
         lyc_interrupt_fired = true;
-        bus.Write8(0xFF0F, bus.Read8(0xFF0F, false) | 0x2, false);
+        bus.Write8(0xFF0F, bus.Peek8(0xFF0F) | 0x2, false);
+    }
+}
+
+void PPU::SetLCDC(u8 value) {
+    const bool was_enabled = IsLCDEnabled();
+    lcdc = value;
+
+    if (was_enabled != IsLCDEnabled()) {
+        UpdateMemoryAccess();
     }
 }
 
+void PPU::SetHardwareMode(HardwareMode new_mode) {
+    FinishPendingLines();
+    hardware_mode = new_mode;
+    LINFO("PPU: switching to {} mode", new_mode == HardwareMode::CGB ? "CGB" : new_mode == HardwareMode::DMG ? "DMG" : "DMG compatibility");
+
+    // The DMG palettes' shades come from somewhere else now.
+    RebuildPalettes();
+    InvalidateLineSignatures();
+}
+
+void PPU::SetMode(Mode new_mode) {
+    mode = new_mode;
+    UpdateMemoryAccess();
+}
+
+void PPU::UpdateMemoryAccess() {
+    // OAM is inaccessible while the PPU is scanning it (mode 2) and drawing (mode 3),
+    // VRAM only while drawing. Everything is accessible while the LCD is off.
+    const bool lcd_enabled = IsLCDEnabled();
+    const bool vram_accessible = !lcd_enabled || mode != Mode::AccessVRAM;
+    const bool oam_accessible = !lcd_enabled || (mode != Mode::AccessOAM && mode != Mode::AccessVRAM);
+    bus.SetPPUMemoryAccess(vram_accessible, oam_accessible);
+}
+
 void PPU::Tick() {
     switch (mode) {
         case Mode::AccessOAM:
-            // TODO: block memory access to VRAM and OAM during this mode
             vcycles++;
             if (vcycles < 80) {
                 return;
@@ -44,80 +98,87 @@ void PPU::Tick() {
 
             vcycles %= 80;
 
-            stat |= 0x3;
-            mode = Mode::AccessVRAM;
-#if HELIAGE_USE_PIXEL_FIFO
-            bg_fifo.Reset();
+            ScanOAM();
+#ifdef HELIAGE_MEMORY_PROFILING
+            ProfileLineFetches();
 #endif
 
+            stat |= 0x3;
+            SetMode(Mode::AccessVRAM);
+            if (renderer == Renderer::PixelFIFO) {
+                StartPixelFIFOLine();
+            }
+
             CheckForLYCoincidence();
             break;
         case Mode::AccessVRAM: { // 172-289 dots
-#if HELIAGE_USE_PIXEL_FIFO
-            RunFIFO(bg_fifo);
+            vcycles++;
 
-            if (bg_fifo.size != 0) {
-                if (IsBGDisplayEnabled()) {
-                    framebuffer[ly * 160 + bg_fifo.draw_x] = GetColorFromBGWindowPalette(bg_fifo.data[0]);
+            if (renderer == Renderer::PixelFIFO) {
+                TickPixelFIFO();
+                if (fifo.lcd_x < 160) {
+                    return;
                 }
-                bg_fifo.draw_x++;
 
-                bg_fifo.size--;
-                for (int i = 0; i < bg_fifo.size; i++) {
-                    bg_fifo.data[i] = bg_fifo.data[i + 1];
+                if (fifo.window_active) {
+                    window_line_counter++;
+                }
+                if (!skip_frame) {
+                    HashTargetLine(ly);
                 }
+            } else if (vcycles < (172 + TemporaryCycleAdjustment)) {
+                return;
             }
-#endif
 
-            vcycles++;
-
-            // TODO: block memory access to VRAM during this mode
-            if (vcycles < (172 + TemporaryCycleAdjustment)) {
-                return;
+            // The line is recorded as mode 3 ends, so an HBlank DMA that's about to run can't
+            // change what it shows.
+            if (!skip_frame && renderer == Renderer::Scanline) {
+                RecordLine();
             }
 
             if (stat & (1 << 3)) {
                 // STAT interrupt
-                bus.Write8(0xFF0F, bus.Read8(0xFF0F, false) | 0x2, false);
+                bus.Write8(0xFF0F, bus.Peek8(0xFF0F) | 0x2, false);
             }
 
-            bg_fifo.draw_x = 0;
-
-            vcycles %= (172 + TemporaryCycleAdjustment);
+            mode3_length = vcycles;
+            vcycles = 0;
             stat &= ~0x3;
-            mode = Mode::HBlank;
+            SetMode(Mode::HBlank);
             CheckForLYCoincidence();
+            bus.RunHBlankDMA();
         }
             break;
         case Mode::HBlank: // 87-204 dots
             vcycles++;
-            if (vcycles < (204 - TemporaryCycleAdjustment)) {
+            // HBlank takes up whatever's left of the 456 dot line.
+            if (vcycles < 456 - 80 - mode3_length) {
                 return;
             }
 
-            RenderScanline();
-
             ly++;
-            vcycles %= (204 - TemporaryCycleAdjustment);
+            vcycles = 0;
 
             CheckForLYCoincidence();
 
             if (ly == 144) {
-                mode = Mode::VBlank;
+                SetMode(Mode::VBlank);
                 stat &= ~0x3;
                 stat |= 0x1;
-                bus.Write8(0xFF0F, bus.Read8(0xFF0F, false) | 0x1, false);
+                bus.Write8(0xFF0F, bus.Peek8(0xFF0F) | 0x1, false);
+
+                bus.ApplyRAMCheats();
 
                 if (stat & (1 << 4)) {
-                    bus.Write8(0xFF0F, bus.Read8(0xFF0F, false) | 0x2, false);
+                    bus.Write8(0xFF0F, bus.Peek8(0xFF0F) | 0x2, false);
                 }
             } else {
                 stat &= ~0x3;
                 stat |= 0x2;
-                mode = Mode::AccessOAM;
+                SetMode(Mode::AccessOAM);
 
                 if (stat & (1 << 5)) {
-                    bus.Write8(0xFF0F, bus.Read8(0xFF0F, false) | 0x2, false);
+                    bus.Write8(0xFF0F, bus.Peek8(0xFF0F) | 0x2, false);
                 }
             }
 
@@ -132,20 +193,65 @@ void PPU::Tick() {
             vcycles %= 456;
 
             if (ly == 154) {
-                DrawFramebuffer(framebuffer);
+                // Always called, even with nothing pending, so the line log starts over every frame.
+                DrawPendingLines();
+
+                last_frame_tile_cache_stats = tile_cache_stats;
+                tile_cache_stats = {};
+                last_frame_line_reuse_stats = line_reuse_stats;
+                line_reuse_stats = {};
+
+                if (!skip_frame) {
+                    frame_line_hashes = line_hashes[current_target];
+                    frame_hash = Scanline::HashLine(reinterpret_cast<const u8*>(frame_line_hashes.data()), sizeof(frame_line_hashes));
+                    if (frame_hash_log.has_value()) {
+                        frame_hash_log->print("{},{:016x}\n", frame_count, frame_hash);
+                    }
+
+                    // Swap before handing the frame over, so DrawFramebuffer can set new render targets.
+                    const RenderTarget finished = render_targets[current_target];
+                    if (render_targets[0].pixels != render_targets[1].pixels) {
+                        current_target ^= 1;
+                    }
+                    if (frame_exporter) {
+                        frame_exporter->Publish(finished, pixel_format, frame_count, frame_hash,
+                                                last_frame_tile_cache_stats, last_frame_line_reuse_stats);
+                    }
+                    DrawFramebuffer(finished);
+                }
+                if (DebugViews* views = debug_views.load(std::memory_order_acquire)) {
+                    views->Update(vram.first<0x2000>(), oam, lcdc, bgp, std::span(tile_epochs).first<384>(), frame_count);
+                }
+                frame_count++;
+#ifdef HELIAGE_MEMORY_PROFILING
+                bus.GetMemoryProfiler().EndFrame();
+#endif
 
-                // Clear the framebuffer
-                std::fill(framebuffer.begin(), framebuffer.end(), Color::White);
+                // Every line of a drawn frame gets overwritten (or reused), so the render target isn't cleared.
+                UpdateFrameskip();
 
                 HandleEvents(bus.GetJoypad());
                 ly = 0;
                 window_line_counter = 0;
-                mode = Mode::AccessOAM;
+                renderer = (hardware_mode == HardwareMode::CGB) ? Renderer::Scanline : pending_renderer.load();
+                if (renderer == Renderer::PixelFIFO) {
+                    // The pixel FIFO draws over whatever the lines were last drawn with.
+                    InvalidateLineSignatures();
+                }
+                if (line_scheduling != pending_line_scheduling) {
+                    line_scheduling = pending_line_scheduling;
+                    if (line_scheduling == LineScheduling::Threaded) {
+                        StartLineWorker();
+                    } else {
+                        StopLineWorker();
+                    }
+                }
+                SetMode(Mode::AccessOAM);
                 stat &= ~0x3;
                 stat |= 0x2;
 
                 if (stat & (1 << 5)) {
-                    bus.Write8(0xFF0F, bus.Read8(0xFF0F, false) | 0x2, false);
+                    bus.Write8(0xFF0F, bus.Peek8(0xFF0F) | 0x2, false);
                 }
             }
 
@@ -157,310 +263,881 @@ void PPU::Tick() {
     }
 }
 
-void PPU::UpdateTile(u16 addr) {
-    if (addr >= 0x9800) {
+void PPU::UpdateFrameskip() {
+    const u32 period = std::max<u32>(frameskip_period, 1);
+    const u32 drawn = period - std::min<u32>(frameskip_skipped, period);
+
+    // Spread the drawn frames out evenly over the period instead of drawing them back to back.
+    frame_in_period = (frame_in_period + 1) % period;
+    skip_frame = (frame_in_period * drawn) / period == ((frame_in_period + 1) * drawn) / period;
+}
+
+void PPU::DecodeTile(u16 tile_index) {
+    const u8* tile = &vram[(tile_index / 384) * 0x2000 + (tile_index % 384) * 16];
+    for (u8 row = 0; row < 8; row++) {
+        tile_rows[tile_index][row] = Scanline::PackTileRow(tile[row * 2], tile[row * 2 + 1]);
+    }
+
+    dirty_tiles.reset(tile_index);
+    tile_cache_stats.tiles_decoded++;
+}
+
+void PPU::ScanOAM() {
+    // The PPU picks the first 10 sprites in OAM order that overlap this line.
+    // Their X position doesn't matter here, so sprites that are off screen horizontally still count.
+    const u8 height = AreSpritesDoubleHeight() ? 16 : 8;
+    line_sprite_count = 0;
+
+    for (u8 sprite_index = 0; sprite_index < 40 && line_sprite_count < 10; sprite_index++) {
+        const u8* entry = &oam[sprite_index * 4];
+        const int top = entry[0] - 16;
+        if (ly < top || ly >= top + height) {
+            continue;
+        }
+
+        Sprite& sprite = line_sprites[line_sprite_count++];
+        sprite.y = entry[0];
+        sprite.x = entry[1];
+        sprite.tile_index = entry[2];
+        sprite.priority = entry[3] & 0x80;
+        sprite.flip_y = entry[3] & 0x40;
+        sprite.flip_x = entry[3] & 0x20;
+        sprite.use_obp1 = entry[3] & 0x10;
+        sprite.bank = entry[3] & 0x08;
+        sprite.cgb_palette = entry[3] & 0x07;
+    }
+
+    // In CGB mode, sprites earlier in OAM are drawn on top, unless OPRI asks for DMG priority.
+    if (hardware_mode == HardwareMode::CGB && !(opri & 0x1)) {
         return;
     }
 
-    u8 byte1 = 0;
-    u8 byte2 = 0;
-    if (addr % 2 == 0) {
-        byte1 = bus.Read8(addr, false);
-        byte2 = bus.Read8(addr + 1, false);
-    } else {
-        byte1 = bus.Read8(addr - 1, false);
-        byte2 = bus.Read8(addr, false);
+    // On the DMG, the sprite with the lowest X is drawn on top.
+    // Ties go to whichever comes first in OAM, which a stable sort keeps.
+    std::stable_sort(line_sprites.begin(), line_sprites.begin() + line_sprite_count,
+                     [](const Sprite& a, const Sprite& b) { return a.x < b.x; });
+}
+
+#ifdef HELIAGE_MEMORY_PROFILING
+// The renderers read VRAM and OAM straight from memory, possibly on another thread, so the
+// fetches the PPU makes for a line are counted here instead: one read per OAM entry scanned,
+// and one tile map and one tile data read per tile drawn.
+void PPU::ProfileLineFetches() {
+    MemoryProfiler& profiler = bus.GetMemoryProfiler();
+    for (u8 sprite_index = 0; sprite_index < 40; sprite_index++) {
+        profiler.RecordRead(0xFE00 + sprite_index * 4, MemoryProfiler::Source::PPU);
     }
-    u16 index = addr - 0x8000;
 
-    u16 tile_index = index / 16;
-    u8 row = (index % 16) / 2; // 2 bytes per row
+    const auto record_tile = [&](u16 tile_map_offset, u8 y, u8 column) {
+        const u16 map_addr = tile_map_offset + (y / 8) * 32 + column % 32;
+        const u8 tile_index = vram[map_addr - 0x8000];
+        const u16 tile_addr = Common::IsBitSet<4>(lcdc) ? 0x8000 + tile_index * 16 : 0x9000 + static_cast<s8>(tile_index) * 16;
+        profiler.RecordRead(map_addr, MemoryProfiler::Source::PPU);
+        profiler.RecordRead(tile_addr + (y % 8) * 2, MemoryProfiler::Source::PPU);
+    };
+
+    const bool cgb = hardware_mode == HardwareMode::CGB;
+    if (IsBGDisplayEnabled() || cgb) {
+        for (u8 column = 0; column < 21; column++) {
+            record_tile(GetBGTileMapDisplayOffset(), ly + scy, scx / 8 + column);
+        }
 
-    for (u8 col = 0; col < 8; col++) {
-        u8 tile = (((byte2 >> (7 - col)) & 0b1) << 1) | ((byte1 >> (7 - col)) & 0b1);
-        tiles[tile_index][row][col] = static_cast<Color>(tile);
+        // The window's line counter is kept by the renderer, which may be behind, so this
+        // assumes the window hasn't been turned off and on again since WY.
+        if (IsWindowDisplayEnabled() && ly >= wy && wx <= 166) {
+            const u8 window_x = std::max<u8>(wx, 7) - 7;
+            for (u8 column = 0; column < (160 - window_x + 7) / 8; column++) {
+                record_tile(GetWindowTileMapDisplayOffset(), ly - wy, column);
+            }
+        }
+    }
+
+    if (IsSpriteDisplayEnabled()) {
+        for (u8 i = 0; i < line_sprite_count; i++) {
+            profiler.RecordRead(0x8000 + line_sprites[i].tile_index * 16, MemoryProfiler::Source::PPU);
+        }
     }
 }
+#endif
 
-void PPU::UpdateSprite(u16 addr) {
-    u8 sprite_index = (addr - 0xFE00) / 4;
-    u16 sprite_base = 0xFE00 + (4 * sprite_index);
-    Sprite* sprite = &sprites[sprite_index];
-    u8 attributes = bus.Read8(sprite_base + 3, false);
+void PPU::RecordLine() {
+    LineState& line = line_log[lines_recorded.load(std::memory_order_relaxed)];
+    line.ly = ly;
+    line.lcdc = lcdc;
+    line.scx = scx;
+    line.scy = scy;
+    line.wx = wx;
+    line.wy = wy;
+    line.bgp = bgp;
+    line.obp0 = obp0;
+    line.obp1 = obp1;
+    line.draw_background = background_drawing_enabled;
+    line.draw_window = window_drawing_enabled;
+    line.draw_sprites = sprite_drawing_enabled;
+    line.palette = composition_lut;
+    line.cgb = hardware_mode == HardwareMode::CGB;
+    if (line.cgb) {
+        line.colors = color_lut;
+    } else if (!IsBGDisplayEnabled()) {
+        // The background and window are blank while they're disabled, but the sprites still show up.
+        const u32 white = GetPixelForPaletteShade(Color::White, 0);
+        for (u8 i = 0; i < 4; i++) {
+            Scanline::SetCompositionEntry<u32>(line.palette, i, white);
+        }
+    }
+    line.sprites = line_sprites;
+    line.sprite_count = line_sprite_count;
 
-    sprite->y = bus.Read8(sprite_base, false);
-    sprite->x = bus.Read8(sprite_base + 1, false);
-    sprite->tile_index = bus.Read8(sprite_base + 2, false);
-    sprite->priority = attributes & 0x80;
-    sprite->flip_y = attributes & 0x40;
-    sprite->flip_x = attributes & 0x20;
-    sprite->use_obp1 = attributes & 0x10;
-}
+    if (line_scheduling == LineScheduling::Immediate) {
+        RenderScanline(line);
+        return;
+    }
 
-void PPU::RenderScanline() {
-#if !HELIAGE_USE_PIXEL_FIFO
-    if (IsBGDisplayEnabled() && background_drawing_enabled) {
-        RenderBackgroundScanline();
+    {
+        std::lock_guard lock(line_mutex);
+        lines_recorded.fetch_add(1, std::memory_order_release);
     }
-#endif
 
-    if (IsWindowDisplayEnabled() && window_drawing_enabled) {
-        RenderWindowScanline();
+    if (line_scheduling == LineScheduling::Threaded) {
+        line_recorded_cv.notify_one();
+    }
+}
+
+void PPU::DrawPendingLines() {
+    if (line_worker.joinable()) {
+        std::unique_lock lock(line_mutex);
+        line_drawn_cv.wait(lock, [this] { return lines_drawn == lines_recorded; });
+        lines_recorded = 0;
+        lines_drawn = 0;
+        return;
     }
 
-    if (IsSpriteDisplayEnabled() && sprite_drawing_enabled) {
-        RenderSpriteScanline();
+    for (u32 i = lines_drawn; i < lines_recorded; i++) {
+        RenderScanline(line_log[i]);
     }
+
+    lines_recorded = 0;
+    lines_drawn = 0;
 }
 
-void PPU::RenderBackgroundScanline() {
-    u16 offset = GetBGTileMapDisplayOffset();
-    bool is_signed = (GetBGWindowTileDataOffset() == 0x8800);
-    u8 screen_y = ly;
-    for (u8 screen_x = 0; screen_x < 160; screen_x++) {
-        u16 scroll_x = screen_x + scx;
-        u16 scroll_y = screen_y + scy;
-        u16 bg_x = scroll_x % 256;
-        u16 bg_y = scroll_y % 256;
-        u16 tile_offset = offset + (bg_x / 8) + (bg_y / 8 * 32);
-        u16 tile_id = bus.Read8(tile_offset, false);
-        if (is_signed && tile_id < 0x80) {
-            tile_id += 0x100;
+void PPU::LineWorker() {
+    std::unique_lock lock(line_mutex);
+    while (true) {
+        line_recorded_cv.wait(lock, [this] { return stopping_line_worker || lines_drawn != lines_recorded; });
+        if (stopping_line_worker) {
+            return;
         }
 
-        u8 tile_y = bg_y % 8;
-        u8 tile_x = bg_x % 8;
+        const u32 index = lines_drawn;
+        lock.unlock();
+        RenderScanline(line_log[index]);
+        lock.lock();
 
-        Color color = GetColorFromBGWindowPalette(tiles[tile_id][tile_y][tile_x]);
-        framebuffer[160 * screen_y + screen_x] = color;
+        lines_drawn.fetch_add(1, std::memory_order_release);
+        line_drawn_cv.notify_one();
     }
 }
 
-void PPU::RenderWindowScanline() {
-    if (ly < wy) {
+void PPU::StartLineWorker() {
+    if (line_worker.joinable()) {
         return;
     }
 
-    if (wx < 7) {
-        // FIXME: Hack. Fixes Link's Awakening's HUD.
-        wx = 7;
-    }
+    stopping_line_worker = false;
+    line_worker = std::thread(&PPU::LineWorker, this);
+}
 
-    if (wx >= 167) {
+void PPU::StopLineWorker() {
+    if (!line_worker.joinable()) {
         return;
     }
 
-    if (wy >= 144) {
+    FinishPendingLines();
+    {
+        std::lock_guard lock(line_mutex);
+        stopping_line_worker = true;
+    }
+    line_recorded_cv.notify_one();
+    line_worker.join();
+}
+
+static u64 MixSignature(u64 signature, u64 value) {
+    signature = (signature ^ value) * 0x9E3779B97F4A7C15;
+    return signature ^ (signature >> 32);
+}
+
+u8 PPU::LineState::GetKernelFlags() const {
+    u8 flags = 0;
+    // On DMG, LCDC bit 0 hides the window along with the background. In CGB mode, it only takes
+    // the background and window's priority over sprites away.
+    if ((IsBGDisplayEnabled() || cgb) && draw_background) {
+        flags |= LineKernelFlags::Background;
+    }
+    if ((IsBGDisplayEnabled() || cgb) && IsWindowDisplayEnabled() && draw_window) {
+        flags |= LineKernelFlags::Window;
+    }
+    if (IsSpriteDisplayEnabled() && draw_sprites) {
+        flags |= LineKernelFlags::Sprites;
+    }
+    if (IsBGWindowTileDataSigned()) {
+        flags |= LineKernelFlags::SignedTiles;
+    }
+    if (AreSpritesDoubleHeight()) {
+        flags |= LineKernelFlags::TallSprites;
+    }
+    return flags;
+}
+
+template <std::size_t... Flags>
+constexpr std::array<PPU::LineKernel, sizeof...(Flags) + 1> PPU::MakeLineKernels(std::index_sequence<Flags...>) {
+    return { &PPU::RenderLine<Flags>..., &PPU::RenderLine<LineKernelFlags::Generic> };
+}
+
+const std::array<PPU::LineKernel, PPU::LineKernelFlags::Generic + 1> PPU::line_kernels =
+    PPU::MakeLineKernels(std::make_index_sequence<PPU::LineKernelFlags::Generic>());
+
+template <u8 Flags>
+bool PPU::IsWindowVisible(const LineState& line) const {
+    return KernelHas<Flags>(line, LineKernelFlags::Window) && line.ly >= line.wy && line.wy < 144 && line.wx < 167;
+}
+
+template <u8 Flags>
+PPU::CellTile PPU::GetCellTile(const LineState& line, u16 tile_map_offset, u16 cell) const {
+    const u16 entry = tile_map_offset - 0x8000 + cell;
+    u16 tile_index = vram[entry];
+    if (KernelHas<Flags>(line, LineKernelFlags::SignedTiles) && tile_index < 0x80) {
+        tile_index += 0x100;
+    }
+
+    if (!KernelIsCGB<Flags>(line)) {
+        return { tile_index, 0 };
+    }
+
+    // The attributes are in the same place in VRAM bank 1. Bit 3 picks the bank the tile comes from.
+    const u8 attributes = vram[0x2000 + entry];
+    if (attributes & 0x08) {
+        tile_index += 384;
+    }
+    return { tile_index, attributes };
+}
+
+template <u8 Flags>
+u64 PPU::ComputeLineSignature(const LineState& line) const {
+    const std::array<u8, 8> registers = { line.lcdc, line.scx, line.scy, line.wx, line.wy, line.bgp, line.obp0, line.obp1 };
+    u64 signature = MixSignature(0, std::bit_cast<u64>(registers));
+    signature = MixSignature(signature, line.draw_background | line.draw_window << 1 | line.draw_sprites << 2 | line.cgb << 3);
+    if (KernelIsCGB<Flags>(line)) {
+        signature = MixSignature(signature, Scanline::HashLine(reinterpret_cast<const u8*>(line.colors.data()), sizeof(line.colors)));
+    }
+
+    const auto mix_tiles = [&](u16 tile_map_offset, u8 y, u8 first_column, u8 columns) {
+        for (u8 i = 0; i < columns; i++) {
+            const CellTile tile = GetCellTile<Flags>(line, tile_map_offset, y / 8 * 32 + (first_column + i) % 32);
+            signature = MixSignature(signature, tile.tile_index | tile.attributes << 16 | static_cast<u64>(tile_epochs[tile.tile_index]) << 24);
+        }
+    };
+
+    if (KernelHas<Flags>(line, LineKernelFlags::Background)) {
+        mix_tiles(line.GetBGTileMapDisplayOffset(), line.ly + line.scy, line.scx / 8, 21);
+    }
+
+    if (IsWindowVisible<Flags>(line)) {
+        signature = MixSignature(signature, window_line_counter);
+        mix_tiles(line.GetWindowTileMapDisplayOffset(), window_line_counter, 0, 21);
+    }
+
+    if (KernelHas<Flags>(line, LineKernelFlags::Sprites)) {
+        signature = MixSignature(signature, line.sprite_count);
+        for (u8 i = 0; i < line.sprite_count; i++) {
+            // Both tiles of the pair count, since an 8x16 sprite can use either.
+            const Sprite& sprite = line.sprites[i];
+            const u32 attributes = sprite.use_obp1 | sprite.flip_x << 1 | sprite.flip_y << 2 | sprite.priority << 3 |
+                                   sprite.bank << 4 | sprite.cgb_palette << 5;
+            signature = MixSignature(signature, sprite.y | sprite.x << 8 | sprite.tile_index << 16 | attributes << 24);
+            const u16 first_tile = ((KernelIsCGB<Flags>(line) && sprite.bank) ? 384 : 0) + (sprite.tile_index & ~0x1);
+            signature = MixSignature(signature, tile_epochs[first_tile] | static_cast<u64>(tile_epochs[first_tile + 1]) << 32);
+        }
+    }
+
+    return signature;
+}
+
+void PPU::RenderScanline(const LineState& line) {
+    const u8 kernel = line.cgb ? LineKernelFlags::Generic : line.GetKernelFlags();
+    (this->*line_kernels[kernel])(line);
+}
+
+template <u8 Flags>
+void PPU::RenderLine(const LineState& line) {
+    const u64 signature = ComputeLineSignature<Flags>(line);
+    std::bitset<144>& valid_signatures = valid_line_signatures[current_target];
+    u64& last_signature = line_signatures[current_target][line.ly];
+    if (valid_signatures[line.ly] && last_signature == signature) {
+        if (IsWindowVisible<Flags>(line)) {
+            window_line_counter++;
+        }
+
+        line_reuse_stats.lines_reused++;
         return;
     }
 
-    u16 offset = GetWindowTileMapDisplayOffset();
-    bool is_signed = (GetBGWindowTileDataOffset() == 0x8800);
+    last_signature = signature;
+    valid_signatures.set(line.ly);
+    line_reuse_stats.lines_rendered++;
 
-    for (u8 screen_x = wx - 7; screen_x < 160; screen_x++) {
-        u8 scroll_x = screen_x - (wx - 7);
-        u8 scroll_y = window_line_counter;
-        u16 tile_offset = offset + (scroll_x / 8) + (scroll_y / 8 * 32);
-        u16 tile_id = bus.Read8(tile_offset, false);
-        if (is_signed && tile_id < 0x80) {
-            tile_id += 0x100;
+    if (KernelHas<Flags>(line, LineKernelFlags::Background)) {
+        RenderBackgroundScanline<Flags>(line);
+    } else {
+        bg_line.fill(0);
+    }
+
+    if (IsWindowVisible<Flags>(line)) {
+        RenderWindowScanline<Flags>(line);
+    }
+
+    obj_line.fill(0);
+    if (KernelHas<Flags>(line, LineKernelFlags::Sprites) && line.sprite_count != 0) {
+        RenderSpriteScanline<Flags>(line);
+    }
+
+    // Every line is drawn in full, since lines are left in the render target from frame to frame.
+    switch (pixel_format) {
+        case PixelFormat::ARGB8888:
+        case PixelFormat::RGBA8888:
+            ComposeScanline<Flags, u32>(line);
+            break;
+        case PixelFormat::RGB565:
+            ComposeScanline<Flags, u16>(line);
+            break;
+        case PixelFormat::Gray8:
+            ComposeScanline<Flags, u8>(line);
+            break;
+    }
+
+    // Reused lines keep the hash they were drawn with.
+    HashTargetLine(line.ly);
+}
+
+template <u8 Flags, typename Pixel>
+void PPU::ComposeScanline(const LineState& line) {
+    if (KernelIsCGB<Flags>(line)) {
+        // LCDC bit 0 is the background and window's master priority over sprites.
+        Scanline::ComposeColorLine(bg_line.data(), obj_line.data(), line.colors, line.IsBGDisplayEnabled(), GetLine<Pixel>(line.ly), 160);
+    } else {
+        Scanline::ComposeLine(bg_line.data(), obj_line.data(), line.palette, GetLine<Pixel>(line.ly), 160);
+    }
+}
+
+void PPU::InvalidateBackgroundPlanes() {
+    for (BackgroundPlane& plane : bg_planes) {
+        plane.cell_tiles.fill(INVALID_CELL);
+    }
+}
+
+void PPU::DrawPlaneCell(BackgroundPlane& plane, u16 cell, CellTile tile) {
+    // CGB attributes: bits 0-2 are the palette, bit 5 flips the tile horizontally, bit 6
+    // vertically, and bit 7 puts it above sprites. DMG cells have none of them.
+    const u8 first_color = (tile.attributes & 0x07) * 4 | ((tile.attributes & 0x80) ? Scanline::CGB_PRIORITY : 0);
+    const u64 first_colors = first_color * 0x0101010101010101;
+
+    u8* out = plane.indices.data() + (cell / 32 * 8 * 256) + (cell % 32 * 8);
+    for (u8 row = 0; row < 8; row++) {
+        u16 tile_row = GetTileRow(tile.tile_index, (tile.attributes & 0x40) ? 7 - row : row);
+        if (tile.attributes & 0x20) {
+            tile_row = Scanline::FlipTileRow(tile_row);
         }
 
-        u8 tile_y = scroll_y % 8;
-        u8 tile_x = scroll_x % 8;
+        const u64 indices = Scanline::UnpackTileRow(tile_row) | first_colors;
+        std::memcpy(out + row * 256, &indices, sizeof(indices));
+    }
+
+    plane.cell_tiles[cell] = tile.tile_index;
+    plane.cell_epochs[cell] = tile_epochs[tile.tile_index];
+    plane.cell_attributes[cell] = tile.attributes;
+}
 
-        Color color = GetColorFromBGWindowPalette(tiles[tile_id][tile_y][tile_x]);
-        framebuffer[160 * ly + screen_x] = color;
+// Brings the cells a line covers up to date and returns the start of that row of the plane.
+template <u8 Flags>
+const u8* PPU::PreparePlaneRow(const LineState& line, u16 tile_map_offset, u8 y, u8 first_column, u8 columns) {
+    BackgroundPlane& plane = bg_planes[tile_map_offset == 0x9C00];
+    const u16 cell_row = y / 8 * 32;
+
+    for (u8 i = 0; i < columns; i++) {
+        const u16 cell = cell_row + (first_column + i) % 32;
+        const CellTile tile = GetCellTile<Flags>(line, tile_map_offset, cell);
+        if (plane.cell_tiles[cell] != tile.tile_index || plane.cell_epochs[cell] != tile_epochs[tile.tile_index] ||
+            plane.cell_attributes[cell] != tile.attributes) {
+            DrawPlaneCell(plane, cell, tile);
+        }
     }
 
+    return plane.indices.data() + (y * 256);
+}
+
+template <u8 Flags>
+void PPU::RenderBackgroundScanline(const LineState& line) {
+    u8 bg_y = line.ly + line.scy;
+    const u8* plane_row = PreparePlaneRow<Flags>(line, line.GetBGTileMapDisplayOffset(), bg_y, line.scx / 8, 21);
+
+    // The visible part of the row wraps around at the right edge of the plane.
+    const u32 before_wrap = std::min<u32>(160, 256 - line.scx);
+    std::memcpy(bg_line.data(), plane_row + line.scx, before_wrap);
+    std::memcpy(bg_line.data() + before_wrap, plane_row, 160 - before_wrap);
+}
+
+template <u8 Flags>
+void PPU::RenderWindowScanline(const LineState& line) {
+    // FIXME: Hack. Fixes Link's Awakening's HUD.
+    const u8 wx = std::max<u8>(line.wx, 7);
+
+    u8 window_x = wx - 7;
+    u8 width = 160 - window_x;
+    const u8* plane_row = PreparePlaneRow<Flags>(line, line.GetWindowTileMapDisplayOffset(), window_line_counter, 0, (width + 7) / 8);
+
+    std::memcpy(bg_line.data() + window_x, plane_row, width);
+
     window_line_counter++;
 }
 
-void PPU::RenderSpriteScanline() {
-    // One of the Gameboy's limitations is that it can only display
-    // 10 sprites per scanline.
-    u8 sprites_this_scanline = 0;
+template <u8 Flags>
+void PPU::RenderSpriteScanline(const LineState& line) {
+    const bool double_height = KernelHas<Flags>(line, LineKernelFlags::TallSprites);
+    const u8 height = double_height ? 16 : 8;
+    const bool cgb = KernelIsCGB<Flags>(line);
 
-    // Sprites can be 8x16 rather than 8x8
-    bool double_height = AreSpritesDoubleHeight();
+    // Draw from lowest to highest priority so the sprites that should be on top are drawn last.
+    // A sprite behind the background still covers lower priority sprites.
+    for (int i = line.sprite_count - 1; i >= 0; i--) {
+        const Sprite& sprite = line.sprites[i];
 
-    // There are 160 bytes of sprite memory available to us;
-    // 4 bytes per sprite means we can have up to 40 sprites.
-    for (u8 sprite_index = 0; sprite_index < 160 / 4; sprite_index++) {
-        Sprite* sprite = &sprites[sprite_index];
+        u8 row = line.ly - (sprite.y - 16);
+        if (sprite.flip_y) {
+            row = height - 1 - row;
+        }
 
-        if (ly < sprite->y - 16 || ly > sprite->y) {
-            continue;
+        // In 8x16 mode, the top tile always has bit 0 cleared and the bottom tile has it set.
+        u16 tile_index = sprite.tile_index;
+        if (double_height) {
+            tile_index = (tile_index & ~0x1) | (row / 8);
+        }
+        if (cgb && sprite.bank) {
+            tile_index += 384;
         }
 
-        // Don't draw any more sprites on this scanline if we have at least 10 sprites on it.
-        if (sprites_this_scanline >= 10) {
-            return;
+        u16 tile_row = GetTileRow(tile_index, row % 8);
+        if (sprite.flip_x) {
+            tile_row = Scanline::FlipTileRow(tile_row);
         }
 
-        if (double_height) {
-            sprite->tile_index &= ~0x1;
+        // Only the columns that are on screen.
+        const int first_col = std::max(0, 8 - sprite.x);
+        const int last_col = std::min(8, 168 - sprite.x);
+        u8 first_color = sprite.use_obp1 ? 8 : 4;
+        u8 flags = sprite.priority ? Scanline::OBJ_BEHIND_BG : 0;
+        if (cgb) {
+            first_color = 32 + sprite.cgb_palette * 4;
+            flags = sprite.priority ? Scanline::CGB_PRIORITY : 0;
         }
+        for (int col = first_col; col < last_col; col++) {
+            const u8 index = (tile_row >> (col * 2)) & 0b11;
 
-        for (u8 row = 0; row < 8; row++) {
-            if (sprite->y + row - 16 >= 144 || sprite->y + row - 16 < 0) {
+            // Color 0 is used for transparency.
+            if (index == 0b00) {
                 continue;
             }
 
-            for (u8 col = 0; col < 8; col++) {
-                if (sprite->x + col - 8 >= 160 || sprite->x + col - 8 < 0) {
-                    continue;
-                }
-
-                u8 x = (sprite->flip_x) ? 7 - col : col;
-                u8 y = (sprite->flip_y) ? 7 - row : row;
-
-                // Color 0 is used for transparency.
-                if (tiles[sprite->tile_index][y][x] == static_cast<Color>(0b00)) {
-                    continue;
-                }
-
-                Color color = GetColorFromSpritePalette(tiles[sprite->tile_index][y][x], sprite->use_obp1);
-                framebuffer[160 * (sprite->y + row - 16) + (sprite->x + col - 8)] = color;
-            }
+            obj_line[sprite.x - 8 + col] = (first_color + index) | flags;
         }
-
-        sprites_this_scanline++;
     }
 }
 
 void PPU::SetBGWindowPalette(u8 value) {
-    bg_window_palette.three = static_cast<Color>((value >> 6) & 0b11);
-    bg_window_palette.two = static_cast<Color>((value >> 4) & 0b11);
-    bg_window_palette.one = static_cast<Color>((value >> 2) & 0b11);
-    bg_window_palette.zero = static_cast<Color>(value & 0b11);
+    bgp = value;
+    BuildPaletteLUT(bg_window_palette, bgp, 0);
+    BuildCompositionLUT();
 
-    LDEBUG("PPU: new background palette: {} {} {} {}", static_cast<u8>(bg_window_palette.three),
-                                                       static_cast<u8>(bg_window_palette.two),
-                                                       static_cast<u8>(bg_window_palette.one),
-                                                       static_cast<u8>(bg_window_palette.zero));
+    LDEBUG("PPU: new background palette: {} {} {} {}", (value >> 6) & 0b11, (value >> 4) & 0b11,
+                                                       (value >> 2) & 0b11, value & 0b11);
 }
 
 void PPU::SetOBP0(u8 value) {
-    obp0.three = static_cast<Color>((value >> 6) & 0b11);
-    obp0.two = static_cast<Color>((value >> 4) & 0b11);
-    obp0.one = static_cast<Color>((value >> 2) & 0b11);
+    obp0 = value;
+    BuildPaletteLUT(obp0_palette, obp0, 32);
+    BuildCompositionLUT();
 
-    LDEBUG("PPU: new OBP0 palette: {} {} {}", static_cast<u8>(obp0.three),
-                                              static_cast<u8>(obp0.two),
-                                              static_cast<u8>(obp0.one));
+    LDEBUG("PPU: new OBP0 palette: {} {} {}", (value >> 6) & 0b11, (value >> 4) & 0b11, (value >> 2) & 0b11);
 }
 
 void PPU::SetOBP1(u8 value) {
-    obp1.three = static_cast<Color>((value >> 6) & 0b11);
-    obp1.two = static_cast<Color>((value >> 4) & 0b11);
-    obp1.one = static_cast<Color>((value >> 2) & 0b11);
-
-    LDEBUG("PPU: new OBP1 palette: {} {} {}", static_cast<u8>(obp1.three),
-                                              static_cast<u8>(obp1.two),
-                                              static_cast<u8>(obp1.one));
-}
-
-PPU::Color PPU::GetColorFromBGWindowPalette(Color color) {
-    switch (static_cast<u8>(color)) {
-        case 0b00:
-            return bg_window_palette.zero;
-        case 0b01:
-            return bg_window_palette.one;
-        case 0b10:
-            return bg_window_palette.two;
-        case 0b11:
-            return bg_window_palette.three;
-        default:
-            // UNREACHABLE_MSG("invalid PPU color {}", static_cast<u8>(color));
-            return bg_window_palette.zero;
+    obp1 = value;
+    BuildPaletteLUT(obp1_palette, obp1, 36);
+    BuildCompositionLUT();
+
+    LDEBUG("PPU: new OBP1 palette: {} {} {}", (value >> 6) & 0b11, (value >> 4) & 0b11, (value >> 2) & 0b11);
+}
+
+u8 PPU::ReadColorPaletteData(const ColorPaletteRAM& ram) const {
+    return IsDrawing() ? 0xFF : ram.data[ram.index];
+}
+
+void PPU::WriteColorPaletteData(ColorPaletteRAM& ram, u8 first_color, u8 value) {
+    // Writes while the PPU is drawing are dropped, but still advance the index.
+    if (!IsDrawing()) {
+        ram.data[ram.index] = value;
+        UpdateColor(first_color + ram.index / 2);
+    }
+
+    if (ram.auto_increment) {
+        ram.index = (ram.index + 1) & 0x3F;
     }
 }
 
-PPU::Color PPU::GetColorFromSpritePalette(Color color, bool use_obp1) {
-    SpritePalette palette = (use_obp1) ? obp1 : obp0;
+void PPU::UpdateColor(u8 color) {
+    const ColorPaletteRAM& ram = (color < 32) ? bg_color_palettes : obj_color_palettes;
+    const u8 offset = (color % 32) * 2;
+    color_lut[color] = GetPixelForColor(ram.data[offset] | (ram.data[offset + 1] & 0x7F) << 8);
+}
 
-    switch (static_cast<u8>(color)) {
-        case 0b01:
-            return palette.one;
-        case 0b10:
-            return palette.two;
-        case 0b11:
-            return palette.three;
+void PPU::RebuildPalettes() {
+    for (u8 color = 0; color < 64; color++) {
+        UpdateColor(color);
+    }
+
+    BuildPaletteLUT(bg_window_palette, bgp, 0);
+    BuildPaletteLUT(obp0_palette, obp0, 32);
+    BuildPaletteLUT(obp1_palette, obp1, 36);
+    BuildPaletteLUT(blank_palette, 0x00, 0);
+    BuildCompositionLUT();
+}
+
+void PPU::SetPixelFormat(PixelFormat format) {
+    FinishPendingLines();
+    pixel_format = format;
+    if (using_internal_framebuffer) {
+        const RenderTarget target { framebuffer.data(), 160 * GetBytesPerPixel(format) };
+        render_targets = { target, target };
+        current_target = 0;
+    }
+
+    RebuildPalettes();
+    ClearFramebuffer();
+    InvalidateLineSignatures();
+}
+
+void PPU::SetRenderTargets(PixelFormat format, RenderTarget first, RenderTarget second) {
+    // Lines that are still pending belong in the old targets.
+    FinishPendingLines();
+    using_internal_framebuffer = false;
+    render_targets = { first, second };
+    current_target = 0;
+    if (format != pixel_format) {
+        SetPixelFormat(format);
+    }
+
+    // Whatever the targets hold isn't what the lines were last drawn with.
+    InvalidateLineSignatures();
+}
+
+bool PPU::ExportFrames(const std::string& instance_name) {
+    frame_exporter = std::make_unique<FrameExporter>(instance_name);
+    if (!frame_exporter->IsOpen()) {
+        frame_exporter.reset();
+        return false;
+    }
+
+    return true;
+}
+
+void PPU::SetFrameHashLog(const std::filesystem::path& path) {
+    frame_hash_log.emplace(fmt::output_file(path.string()));
+    frame_hash_log->print("frame,hash\n");
+    LINFO("PPU: logging frame hashes to {}", path.string());
+}
+
+void PPU::ResetRenderTargets() {
+    FinishPendingLines();
+    using_internal_framebuffer = true;
+    SetPixelFormat(pixel_format);
+}
+
+u32 PPU::GetPixelForShade(Color shade) const {
+    const u8 gray = ~(static_cast<u8>(shade) * 0x55);
+
+    switch (pixel_format) {
+        case PixelFormat::ARGB8888:
+            return 0xFF << 24 | gray << 16 | gray << 8 | gray;
+        case PixelFormat::RGBA8888:
+            return gray << 24 | gray << 16 | gray << 8 | 0xFF;
+        case PixelFormat::RGB565:
+            return (gray >> 3) << 11 | (gray >> 2) << 5 | (gray >> 3);
+        case PixelFormat::Gray8:
+            return gray;
         default:
-            UNREACHABLE_MSG("invalid PPU color {}", static_cast<u8>(color));
+            UNREACHABLE_MSG("invalid pixel format {}", static_cast<u32>(pixel_format));
     }
 }
 
-void PPU::RunFIFO(PixelFIFO& fifo) {
-    switch (fifo.state) {
-        case PixelFIFO::State::GetTile_Cycle1: {
-            fifo.fetcher_x = ((fifo.draw_x + scx + 8) / 8) % 32;
-            fifo.fetcher_y = ly + scy;
-            u16 tilemap_address = 0x9800;
-            if (Common::IsBitSet<3>(lcdc) && fifo.draw_x < wx) {
-                tilemap_address = 0x9C00;
-            }
-            if (Common::IsBitSet<6>(lcdc) && fifo.draw_x >= wx) {
-                tilemap_address = 0x9C00;
+u32 PPU::GetPixelForColor(u16 rgb555) const {
+    // Stretch each 5-bit channel out to 8 bits, so full intensity is still 0xFF.
+    const auto expand = [](u32 channel) { return channel << 3 | channel >> 2; };
+    const u32 red = expand(rgb555 & 0x1F);
+    const u32 green = expand((rgb555 >> 5) & 0x1F);
+    const u32 blue = expand((rgb555 >> 10) & 0x1F);
+
+    switch (pixel_format) {
+        case PixelFormat::ARGB8888:
+            return 0xFF << 24 | red << 16 | green << 8 | blue;
+        case PixelFormat::RGBA8888:
+            return red << 24 | green << 16 | blue << 8 | 0xFF;
+        case PixelFormat::RGB565:
+            return (red >> 3) << 11 | (green >> 2) << 5 | (blue >> 3);
+        case PixelFormat::Gray8:
+            return (red * 77 + green * 150 + blue * 29) >> 8;
+        default:
+            UNREACHABLE_MSG("invalid pixel format {}", static_cast<u32>(pixel_format));
+    }
+}
+
+u32 PPU::GetPixelForPaletteShade(Color shade, u8 first_color) const {
+    if (hardware_mode == HardwareMode::DMGCompatibility) {
+        return color_lut[first_color + static_cast<u8>(shade)];
+    }
+    return GetPixelForShade(shade);
+}
+
+void PPU::BuildPaletteLUT(Scanline::PaletteLUT& lut, u8 palette, u8 first_color) const {
+    for (u8 i = 0; i < 4; i++) {
+        const u32 pixel = GetPixelForPaletteShade(static_cast<Color>((palette >> (i * 2)) & 0b11), first_color);
+        switch (GetBytesPerPixel(pixel_format)) {
+            case 4:
+                Scanline::SetPaletteEntry<u32>(lut, i, pixel);
+                break;
+            case 2:
+                Scanline::SetPaletteEntry<u16>(lut, i, pixel);
+                break;
+            default:
+                Scanline::SetPaletteEntry<u8>(lut, i, pixel);
+                break;
+        }
+    }
+}
+
+void PPU::BuildCompositionLUT() {
+    // The entries past the pixel size just go unused, so they can all be set as 32-bit pixels.
+    const u8 palettes[3] = { bgp, obp0, obp1 };
+    const u8 first_colors[3] = { 0, 32, 36 };
+    for (u8 palette = 0; palette < 3; palette++) {
+        for (u8 i = 0; i < 4; i++) {
+            const Color shade = static_cast<Color>((palettes[palette] >> (i * 2)) & 0b11);
+            Scanline::SetCompositionEntry<u32>(composition_lut, palette * 4 + i, GetPixelForPaletteShade(shade, first_colors[palette]));
+        }
+    }
+}
+
+void PPU::ClearFramebuffer() {
+    const u32 white = GetPixelForShade(Color::White);
+    const u32 bytes_per_pixel = GetBytesPerPixel(pixel_format);
+    for (const RenderTarget& target : render_targets) {
+        for (u32 line = 0; line < 144; line++) {
+            u8* pixels = target.pixels + line * target.pitch;
+            for (u32 x = 0; x < 160; x++) {
+                std::memcpy(&pixels[x * bytes_per_pixel], &white, bytes_per_pixel);
             }
+        }
+    }
 
-            // fifo.fetcher_x = scx + ((fifo.draw_x + 8) / 8) % 32;
+    const u64 white_line_hash = Scanline::HashLine(render_targets[0].pixels, 160 * bytes_per_pixel);
+    for (std::array<u64, 144>& hashes : line_hashes) {
+        hashes.fill(white_line_hash);
+    }
+}
 
-            fifo.tile_index_address = tilemap_address + ((fifo.fetcher_y / 8) * 32) + fifo.fetcher_x;
-            fifo.state = PixelFIFO::State::GetTile_Cycle2;
-            break;
+void PPU::StartPixelFIFOLine() {
+    fifo = {};
+
+    // The first tile fetch of every line is thrown away.
+    fifo.startup_dots = 6;
+    fifo.discard = scx % 8;
+    // The pixel FIFO only runs in DMG mode, where LCDC bit 0 hides the window too.
+    fifo.window_active = IsBGDisplayEnabled() && IsWindowDisplayEnabled() && window_drawing_enabled && ly >= wy && wx < 167;
+}
+
+void PPU::TickPixelFIFO() {
+    if (fifo.startup_dots != 0) {
+        fifo.startup_dots--;
+        return;
+    }
+
+    // A sprite starting at the current position holds up pixel output until it's been fetched.
+    // Line sprites are sorted by X, so only the next one needs checking. Sprites at X=0 are
+    // entirely off screen and never fetched.
+    if (!fifo.fetching_sprite && fifo.discard == 0 && IsSpriteDisplayEnabled() && sprite_drawing_enabled) {
+        while (fifo.next_sprite < line_sprite_count && line_sprites[fifo.next_sprite].x == 0) {
+            fifo.next_sprite++;
         }
-        case PixelFIFO::State::GetTile_Cycle2:
-            fifo.tile_index = bus.Read8(fifo.tile_index_address, false);
-            fifo.state = PixelFIFO::State::GetTileDataLow_Cycle1;
-            break;
 
-        case PixelFIFO::State::GetTileDataLow_Cycle1:
-            fifo.tile_data_address = GetBGWindowTileDataOffset();
-            if (fifo.tile_data_address == 0x8800) {
-                if (fifo.tile_index < 0x80) {
-                    fifo.tile_data_address += 0x800;
-                } else {
-                    fifo.tile_index -= 0x80;
-                }
+        if (fifo.next_sprite < line_sprite_count && line_sprites[fifo.next_sprite].x <= fifo.lcd_x + 8) {
+            fifo.fetching_sprite = true;
+            fifo.sprite_fetch_dots = 0;
+        }
+    }
+
+    if (fifo.fetching_sprite) {
+        // The background fetcher has to have something in the FIFO before it gives way.
+        if (fifo.bg_count == 0) {
+            StepBackgroundFetcher();
+            return;
+        }
+
+        if (++fifo.sprite_fetch_dots < 6) {
+            return;
+        }
+
+        LoadSpriteIntoFIFO(line_sprites[fifo.next_sprite]);
+        fifo.next_sprite++;
+        fifo.fetching_sprite = false;
+        return;
+    }
+
+    StepBackgroundFetcher();
+    if (fifo.bg_count == 0) {
+        return;
+    }
+
+    // Reaching the window throws away the background pixels and restarts the fetcher on the window.
+    if (fifo.window_active && !fifo.fetching_window && fifo.discard == 0 && fifo.lcd_x + 7 >= wx) {
+        fifo.fetching_window = true;
+        fifo.bg_pixels = 0;
+        fifo.bg_count = 0;
+        fifo.fetcher_x = 0;
+        fifo.step = PixelFIFO::FetchStep::Tile;
+        fifo.step_dots = 0;
+        return;
+    }
+
+    const u8 bg_index = fifo.bg_pixels & 0b11;
+    fifo.bg_pixels >>= 2;
+    fifo.bg_count--;
+
+    if (fifo.discard != 0) {
+        fifo.discard--;
+        return;
+    }
+
+    const u8 obj_index = fifo.obj_pixels & 0b11;
+    const bool use_obp1 = fifo.obj_palettes & 1;
+    const bool bg_over_obj = fifo.obj_priorities & 1;
+    fifo.obj_pixels >>= 2;
+    fifo.obj_palettes >>= 1;
+    fifo.obj_priorities >>= 1;
+
+    OutputFIFOPixel(bg_index, obj_index, use_obp1, bg_over_obj);
+    fifo.lcd_x++;
+}
+
+void PPU::StepBackgroundFetcher() {
+    // Every step but pushing takes 2 dots. Pushing waits until the FIFO is empty.
+    if (fifo.step != PixelFIFO::FetchStep::Push && ++fifo.step_dots < 2) {
+        return;
+    }
+    fifo.step_dots = 0;
+
+    switch (fifo.step) {
+        case PixelFIFO::FetchStep::Tile: {
+            u16 tile_map_address;
+            if (fifo.fetching_window) {
+                tile_map_address = GetWindowTileMapDisplayOffset() + (window_line_counter / 8 * 32) + fifo.fetcher_x;
+            } else {
+                const u8 bg_y = ly + scy;
+                tile_map_address = GetBGTileMapDisplayOffset() + (bg_y / 8 * 32) + ((scx / 8 + fifo.fetcher_x) % 32);
             }
-            fifo.tile_data_address += (fifo.tile_index * 16) + ((fifo.fetcher_y % 8) * 2);
-            fifo.state = PixelFIFO::State::GetTileDataLow_Cycle2;
-            break;
-        case PixelFIFO::State::GetTileDataLow_Cycle2:
-            fifo.tile_data[0] = bus.Read8(fifo.tile_data_address, false);
-            fifo.state = PixelFIFO::State::GetTileDataHigh_Cycle1;
-            break;
 
-        case PixelFIFO::State::GetTileDataHigh_Cycle1:
-            fifo.tile_data_address++;
-            fifo.state = PixelFIFO::State::GetTileDataHigh_Cycle2;
+            fifo.tile_id = vram[tile_map_address - 0x8000];
+            fifo.step = PixelFIFO::FetchStep::DataLow;
             break;
-        case PixelFIFO::State::GetTileDataHigh_Cycle2:
-            fifo.tile_data[1] = bus.Read8(fifo.tile_data_address, false);
-            fifo.state = PixelFIFO::State::Sleep_Cycle1;
+        }
+        case PixelFIFO::FetchStep::DataLow:
+            fifo.step = PixelFIFO::FetchStep::DataHigh;
             break;
+        case PixelFIFO::FetchStep::DataHigh: {
+            // Both bitplanes come out of the tile cache at once.
+            u16 tile_index = fifo.tile_id;
+            if (GetBGWindowTileDataOffset() == 0x8800 && tile_index < 0x80) {
+                tile_index += 0x100;
+            }
 
-        case PixelFIFO::State::Sleep_Cycle1:
-            fifo.state = PixelFIFO::State::Sleep_Cycle2;
-            break;
-        case PixelFIFO::State::Sleep_Cycle2:
-            fifo.state = PixelFIFO::State::Push;
+            const u8 tile_y = fifo.fetching_window ? window_line_counter % 8 : static_cast<u8>(ly + scy) % 8;
+            fifo.tile_row = GetTileRow(tile_index, tile_y);
+            fifo.step = PixelFIFO::FetchStep::Push;
             break;
-
-        case PixelFIFO::State::Push:
-            if (fifo.size != 0) {
+        }
+        case PixelFIFO::FetchStep::Push:
+            if (fifo.bg_count != 0) {
                 break;
             }
-            fifo.size = 8;
-            for (int i = 0; i < 8; i++) {
-                fifo.data[i] = Color((fifo.tile_data[1] >> 7) << 1 | (fifo.tile_data[0] >> 7));
-                fifo.tile_data[0] <<= 1;
-                fifo.tile_data[1] <<= 1;
-            }
 
-            fifo.state = PixelFIFO::State::GetTile_Cycle1;
+            fifo.bg_pixels = fifo.tile_row;
+            fifo.bg_count = 8;
+            fifo.fetcher_x++;
+            fifo.step = PixelFIFO::FetchStep::Tile;
             break;
     }
 }
+
+void PPU::LoadSpriteIntoFIFO(const Sprite& sprite) {
+    const bool double_height = AreSpritesDoubleHeight();
+    const u8 height = double_height ? 16 : 8;
+
+    u8 row = ly - (sprite.y - 16);
+    if (sprite.flip_y) {
+        row = height - 1 - row;
+    }
+
+    u16 tile_index = sprite.tile_index;
+    if (double_height) {
+        tile_index = (tile_index & ~0x1) | ((row / 8) & 0x1);
+    }
+
+    u16 tile_row = GetTileRow(tile_index, row % 8);
+    if (sprite.flip_x) {
+        tile_row = Scanline::FlipTileRow(tile_row);
+    }
+
+    // Sprites hanging off the left edge of the screen lose the pixels that are off screen.
+    const u8 hidden_pixels = fifo.lcd_x + 8 - sprite.x;
+    tile_row >>= hidden_pixels * 2;
+
+    // Pixels already in the FIFO came from sprites with higher priority, so only
+    // transparent slots get filled.
+    for (u8 pixel = 0; pixel < 8 - hidden_pixels; pixel++) {
+        const u16 index = (tile_row >> (pixel * 2)) & 0b11;
+        if (index == 0 || ((fifo.obj_pixels >> (pixel * 2)) & 0b11) != 0) {
+            continue;
+        }
+
+        fifo.obj_pixels |= index << (pixel * 2);
+        fifo.obj_palettes |= sprite.use_obp1 << pixel;
+        fifo.obj_priorities |= sprite.priority << pixel;
+    }
+}
+
+void PPU::OutputFIFOPixel(u8 bg_index, u8 obj_index, bool use_obp1, bool bg_over_obj) {
+    const Scanline::PaletteLUT* palette = &bg_window_palette;
+    if (!IsBGDisplayEnabled() || !background_drawing_enabled) {
+        palette = &blank_palette;
+        bg_index = 0;
+    }
+
+    u8 index = bg_index;
+    if (obj_index != 0 && !(bg_over_obj && bg_index != 0)) {
+        palette = use_obp1 ? &obp1_palette : &obp0_palette;
+        index = obj_index;
+    }
+
+    if (skip_frame) {
+        return;
+    }
+
+    const u32 bytes_per_pixel = GetBytesPerPixel(pixel_format);
+    std::memcpy(GetLine<u8>(ly) + fifo.lcd_x * bytes_per_pixel, &(*palette)[index * bytes_per_pixel], bytes_per_pixel);
+}
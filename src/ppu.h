@@ -1,12 +1,30 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <bitset>
+#include <condition_variable>
+#include <filesystem>
+#include <fmt/os.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 #include "common/bits.h"
 #include "common/types.h"
+#include "scanline.h"
 
 class Bus;
+class DebugViews;
+class FrameExporter;
+struct LineKernelBenchmark;
 
 class PPU {
+    friend struct LineKernelBenchmark;
 public:
     enum class Mode {
         HBlank,
@@ -15,6 +33,15 @@ public:
         AccessVRAM,
     };
 
+    // What the PPU draws like. A CGB running a DMG cartridge is in DMGCompatibility mode: it draws
+    // like a DMG, but the shades BGP, OBP0 and OBP1 pick are colors from CGB background palette 0
+    // and sprite palettes 0 and 1, which the boot ROM fills in.
+    enum class HardwareMode {
+        DMG,
+        CGB,
+        DMGCompatibility,
+    };
+
     enum class Color : u8 {
         White = 0b00,
         LightGray = 0b01,
@@ -22,17 +49,104 @@ public:
         Black = 0b11,
     };
 
+    // The format pixels are written to the framebuffer in. The 32 and 16-bit formats are
+    // packed native-endian values, e.g. ARGB8888 is 0xAARRGGBB.
+    enum class PixelFormat {
+        ARGB8888,
+        RGBA8888,
+        RGB565,
+        Gray8,
+    };
+
+    static constexpr u32 GetBytesPerPixel(PixelFormat format) {
+        switch (format) {
+            case PixelFormat::ARGB8888:
+            case PixelFormat::RGBA8888:
+                return 4;
+            case PixelFormat::RGB565:
+                return 2;
+            case PixelFormat::Gray8:
+            default:
+                return 1;
+        }
+    }
+
+    // Big enough for a frame in any pixel format.
+    using Framebuffer = std::array<u8, 160 * 144 * 4>;
+
+    // Somewhere for frames to be drawn: 144 lines of 160 pixels, each line `pitch` bytes after the last.
+    struct RenderTarget {
+        u8* pixels = nullptr;
+        u32 pitch = 0;
+    };
+
     PPU(Bus& bus);
+    ~PPU();
 
     void AdvanceCycles(u64 cycles);
 
+    struct TileCacheStats {
+        // Tiles decoded from VRAM because the renderer used them while they were dirty.
+        u32 tiles_decoded = 0;
+        // VRAM writes to tile data.
+        u32 tile_writes = 0;
+    };
+
     void Tick();
-    void UpdateTile(u16 addr);
 
-    void UpdateSprite(u16 addr);
+    // Must be called before VRAM changes, so lines that were recorded but haven't been drawn yet
+    // still see VRAM as it was when they ended.
+    void FinishPendingLines() {
+        if (lines_drawn.load(std::memory_order_acquire) != lines_recorded.load(std::memory_order_relaxed)) {
+            DrawPendingLines();
+        }
+    }
+
+    // Tiles in VRAM bank 1 are numbered 384-767.
+    void MarkTileDirty(u16 addr, u8 bank) {
+        if (addr < 0x9800) {
+            const u16 tile_index = bank * 384 + (addr - 0x8000) / 16;
+            dirty_tiles.set(tile_index);
+            tile_epochs[tile_index]++;
+            tile_cache_stats.tile_writes++;
+        }
+    }
+
+    struct LineReuseStats {
+        // Lines left alone because everything they depend on was the same as last frame.
+        u32 lines_reused = 0;
+        u32 lines_rendered = 0;
+    };
+
+    // Stats for the last completed frame.
+    const TileCacheStats& GetTileCacheStats() const { return last_frame_tile_cache_stats; }
+    const LineReuseStats& GetLineReuseStats() const { return last_frame_line_reuse_stats; }
+
+    // Frames completed since power on, skipped ones included.
+    u64 GetFrameCount() const { return frame_count; }
+
+    // A hash of the last drawn frame's pixels, built from a hash of every line taken as it's drawn.
+    // It depends on the pixel format, but not on the renderer or how lines are scheduled.
+    u64 GetFrameHash() const { return frame_hash; }
+    // The hash of every line of the last drawn frame, which the frame hash is built from.
+    const std::array<u64, 144>& GetLineHashes() const { return frame_line_hashes; }
+    // Starts appending the frame number and hash of every drawn frame to the given file, as CSV.
+    void SetFrameHashLog(const std::filesystem::path& path);
+
+    // Also publishes every drawn frame into shared memory for out-of-process viewers
+    // (see FrameExporter). Returns false if the shared memory couldn't be set up.
+    bool ExportFrames(const std::string& instance_name);
+
+    // Keeps the debug views up to date at the end of every frame, or stops if null.
+    // Can be called from any thread.
+    void AttachDebugViews(DebugViews* views) { debug_views.store(views, std::memory_order_release); }
+
+    HardwareMode GetHardwareMode() const { return hardware_mode; }
+    // Only ever changes from CGB to DMGCompatibility, when a CGB boot ROM finishes.
+    void SetHardwareMode(HardwareMode mode);
 
     u8 GetLCDC() const { return lcdc; }
-    void SetLCDC(u8 value) { lcdc = value; }
+    void SetLCDC(u8 value);
 
     u8 GetSTAT() const { return stat; }
     void SetSTAT(u8 value) { stat = value; }
@@ -52,6 +166,75 @@ public:
     void SetOBP0(u8 value);
     void SetOBP1(u8 value);
 
+    // CGB palette RAM, accessed through an index register each (BCPS/OCPS) whose bit 7 makes
+    // the index advance after every write to the data register (BCPD/OCPD).
+    u8 GetBCPS() const { return bg_color_palettes.GetIndexRegister(); }
+    void SetBCPS(u8 value) { bg_color_palettes.SetIndexRegister(value); }
+    u8 GetBCPD() const { return ReadColorPaletteData(bg_color_palettes); }
+    void SetBCPD(u8 value) { WriteColorPaletteData(bg_color_palettes, 0, value); }
+
+    u8 GetOCPS() const { return obj_color_palettes.GetIndexRegister(); }
+    void SetOCPS(u8 value) { obj_color_palettes.SetIndexRegister(value); }
+    u8 GetOCPD() const { return ReadColorPaletteData(obj_color_palettes); }
+    void SetOCPD(u8 value) { WriteColorPaletteData(obj_color_palettes, 32, value); }
+
+    // Bit 0 set gives sprites DMG-style priority (lowest X on top) in CGB mode.
+    u8 GetOPRI() const { return opri; }
+    void SetOPRI(u8 value) { opri = value & 0x1; }
+
+    PixelFormat GetPixelFormat() const { return pixel_format; }
+    void SetPixelFormat(PixelFormat format);
+
+    // Draws frames straight into memory the host owns, like a locked streaming texture or a shared
+    // memory segment, instead of the PPU's own framebuffer. Frames alternate between the two targets:
+    // at VBlank the finished one is handed to DrawFramebuffer and the next frame goes into the other.
+    // Pass the same target twice to draw every frame into it. Targets are only cleared if the format
+    // changes, since every line of a drawn frame is written. They have to stay valid, and be left alone,
+    // until targets are set again (even to the same ones). Call from the emulation thread, e.g. from
+    // DrawFramebuffer, or while it isn't running.
+    void SetRenderTargets(PixelFormat format, RenderTarget first, RenderTarget second);
+    // Goes back to drawing into the PPU's own framebuffer.
+    void ResetRenderTargets();
+
+    enum class Renderer {
+        // Draws each line in one go at the end of the line. Fast, but mid-line register
+        // writes are missed and mode 3 is always the same length.
+        Scanline,
+        // Runs the background, window and sprite fetchers and FIFOs dot by dot like the hardware,
+        // with mode 3 stretched by scrolling, the window and sprites.
+        PixelFIFO,
+    };
+
+    // Takes effect at the start of the next frame. The pixel FIFO only draws like a DMG, so
+    // the scanline renderer is always used in CGB mode.
+    void SetRenderer(Renderer new_renderer) { pending_renderer = new_renderer; }
+    Renderer GetRenderer() const { return renderer; }
+
+    // When the scanline renderer draws the lines it records. Every line is recorded with the
+    // registers, palettes and sprites it ended with, so deferring it doesn't change what it looks like.
+    enum class LineScheduling {
+        // Each line is drawn on the emulation thread as soon as it ends.
+        Immediate,
+        // Lines are drawn in a batch on the emulation thread, when VRAM is about to change
+        // or the frame ends.
+        Deferred,
+        // Lines are drawn on a worker thread while the emulation thread carries on.
+        Threaded,
+    };
+
+    // Takes effect at the start of the next frame.
+    void SetLineScheduling(LineScheduling scheduling) { pending_line_scheduling = scheduling; }
+    LineScheduling GetLineScheduling() const { return line_scheduling; }
+
+    // Skip drawing `skipped` out of every `period` frames. Skipped frames still run the mode
+    // state machine, LYC checks and interrupts exactly, they just don't generate any pixels
+    // or hand a frame to the frontend. Takes effect at the start of the next frame.
+    void SetFrameskip(u32 skipped, u32 period) {
+        frameskip_skipped = skipped;
+        frameskip_period = period;
+    }
+    bool IsFrameSkipped() const { return skip_frame; }
+
     u8 GetWY() const { return wy; }
     void SetWY(u8 value) { wy = value; }
 
@@ -72,6 +255,9 @@ public:
     void SetSpriteDrawingEnabled(bool enabled) { sprite_drawing_enabled = enabled; }
 private:
     Bus& bus;
+    // Both banks, bank 1 at 0x2000.
+    std::span<const u8, 0x4000> vram;
+    std::span<const u8, 0xA0> oam;
     u64 vcycles = 0;
     u8 lcdc = 0x00;
     u8 stat = 0x80;
@@ -82,25 +268,83 @@ private:
     u8 wy = 0x00;
     u8 wx = 0x00;
     Mode mode = Mode::AccessOAM;
+    HardwareMode hardware_mode = HardwareMode::DMG;
 
     bool lyc_interrupt_fired = false;
     void CheckForLYCoincidence();
 
-    struct {
-        Color three;
-        Color two;
-        Color one;
-        Color zero;
-    } bg_window_palette;
-
-    // Sprite palettes have 3 colors instead of 4. The lost color is used for transparency.
-    struct SpritePalette {
-        Color three;
-        Color two;
-        Color one;
+    void SetMode(Mode new_mode);
+    void UpdateMemoryAccess();
+    // VRAM and palette RAM are off limits to the CPU while the PPU is drawing.
+    bool IsDrawing() const { return IsLCDEnabled() && mode == Mode::AccessVRAM; }
+
+    // The raw palette registers, and the output pixel for each of their color indices
+    // in the current pixel format. Color 0 of the sprite palettes is transparent, so
+    // its entry is never used.
+    u8 bgp = 0x00;
+    u8 obp0 = 0x00;
+    u8 obp1 = 0x00;
+    Scanline::PaletteLUT bg_window_palette {};
+    Scanline::PaletteLUT obp0_palette {};
+    Scanline::PaletteLUT obp1_palette {};
+    // Every entry is white, for when the background is disabled.
+    Scanline::PaletteLUT blank_palette {};
+    // All three palettes in one table, for the scanline renderer.
+    Scanline::CompositionLUT composition_lut {};
+    void BuildCompositionLUT();
+
+    // 8 palettes of 4 colors, each color little-endian RGB555.
+    struct ColorPaletteRAM {
+        std::array<u8, 64> data {};
+        u8 index = 0;
+        bool auto_increment = false;
+
+        // Bit 6 is unused.
+        u8 GetIndexRegister() const { return auto_increment << 7 | 0x40 | index; }
+        void SetIndexRegister(u8 value) {
+            index = value & 0x3F;
+            auto_increment = value & 0x80;
+        }
     };
 
-    SpritePalette obp0, obp1;
+    ColorPaletteRAM bg_color_palettes {};
+    ColorPaletteRAM obj_color_palettes {};
+    u8 opri = 0x00;
+    // Palette RAM as output pixels, converted whenever a color is written, so CGB lines are
+    // composed with a single lookup per pixel like DMG ones.
+    Scanline::ColorLUT color_lut {};
+    u8 ReadColorPaletteData(const ColorPaletteRAM& ram) const;
+    void WriteColorPaletteData(ColorPaletteRAM& ram, u8 first_color, u8 value);
+    // Converts a color (0-31 background, 32-63 sprites) from palette RAM into color_lut.
+    void UpdateColor(u8 color);
+    // Converts all of palette RAM and rebuilds the DMG palette LUTs, for a new pixel format or hardware mode.
+    void RebuildPalettes();
+
+    PixelFormat pixel_format = PixelFormat::ARGB8888;
+
+    u64 frame_count = 0;
+    std::unique_ptr<FrameExporter> frame_exporter;
+    std::atomic<DebugViews*> debug_views = nullptr;
+
+    // The hash of every line in each render target, as it was last drawn.
+    std::array<std::array<u64, 144>, 2> line_hashes {};
+    std::array<u64, 144> frame_line_hashes {};
+    u64 frame_hash = 0;
+    std::optional<fmt::ostream> frame_hash_log;
+    void HashTargetLine(u8 line) {
+        line_hashes[current_target][line] = Scanline::HashLine(GetLine<u8>(line), 160 * GetBytesPerPixel(pixel_format));
+    }
+
+    std::atomic<u32> frameskip_skipped = 0;
+    std::atomic<u32> frameskip_period = 1;
+    u32 frame_in_period = 0;
+    bool skip_frame = false;
+    void UpdateFrameskip();
+    u32 GetPixelForShade(Color shade) const;
+    u32 GetPixelForColor(u16 rgb555) const;
+    // A DMG shade, or in DMG compatibility mode, that color of the CGB palette starting at first_color.
+    u32 GetPixelForPaletteShade(Color shade, u8 first_color) const;
+    void BuildPaletteLUT(Scanline::PaletteLUT& lut, u8 palette, u8 first_color) const;
 
     struct Sprite {
         u8 y = 0;
@@ -110,58 +354,263 @@ private:
         bool flip_x = false;
         bool flip_y = false;
         bool priority = false;
+        // CGB mode only.
+        u8 cgb_palette = 0;
+        bool bank = false;
     };
 
-    std::array<Sprite, 40> sprites = {};
+    // The sprites on the current line, found by the mode 2 OAM scan and
+    // ordered from highest to lowest drawing priority.
+    std::array<Sprite, 10> line_sprites = {};
+    u8 line_sprite_count = 0;
+
+    void ScanOAM();
+#ifdef HELIAGE_MEMORY_PROFILING
+    void ProfileLineFetches();
+#endif
+
+    // Everything the scanline renderer needs to draw a line besides VRAM, as it was when the line ended.
+    struct LineState {
+        u8 ly = 0;
+        u8 lcdc = 0;
+        u8 scx = 0;
+        u8 scy = 0;
+        u8 wx = 0;
+        u8 wy = 0;
+        u8 bgp = 0;
+        u8 obp0 = 0;
+        u8 obp1 = 0;
+        bool draw_background = true;
+        bool draw_window = true;
+        bool draw_sprites = true;
+        Scanline::CompositionLUT palette {};
+        // CGB mode lines use tile attributes and draw through `colors` instead of `palette`.
+        bool cgb = false;
+        Scanline::ColorLUT colors {};
+        std::array<Sprite, 10> sprites = {};
+        u8 sprite_count = 0;
+
+        u16 GetWindowTileMapDisplayOffset() const { return (Common::IsBitSet<6>(lcdc)) ? 0x9C00 : 0x9800; }
+        bool IsWindowDisplayEnabled() const { return Common::IsBitSet<5>(lcdc); }
+        bool IsBGWindowTileDataSigned() const { return !Common::IsBitSet<4>(lcdc); }
+        u16 GetBGTileMapDisplayOffset() const { return Common::IsBitSet<3>(lcdc) ? 0x9C00 : 0x9800; }
+        bool AreSpritesDoubleHeight() const { return Common::IsBitSet<2>(lcdc); }
+        bool IsSpriteDisplayEnabled() const { return Common::IsBitSet<1>(lcdc); }
+        bool IsBGDisplayEnabled() const { return Common::IsBitSet<0>(lcdc); }
+
+        u8 GetKernelFlags() const;
+    };
 
-    std::array<Color, 160 * 144> framebuffer;
-    Color tiles[384][8][8];
+    // The LCDC bits (combined with the debug drawing toggles) the line kernels are specialized on.
+    // The tile map selects aren't included, since they only pick which plane a line reads from.
+    struct LineKernelFlags {
+        static constexpr u8 Background = 1 << 0;
+        static constexpr u8 Window = 1 << 1;
+        static constexpr u8 Sprites = 1 << 2;
+        static constexpr u8 SignedTiles = 1 << 3;
+        static constexpr u8 TallSprites = 1 << 4;
+        // Not a specialization, checks all of the above on the line at runtime.
+        static constexpr u8 Generic = 1 << 5;
+    };
 
-    Color GetColorFromBGWindowPalette(Color color);
-    Color GetColorFromSpritePalette(Color color, bool use_obp1);
+    // CGB lines always take the generic kernel, so the specialized kernels only ever draw DMG lines.
+    template <u8 Flags>
+    static bool KernelIsCGB(const LineState& line) {
+        if constexpr ((Flags & LineKernelFlags::Generic) != 0) {
+            return line.cgb;
+        } else {
+            return false;
+        }
+    }
+
+    // Whether a line kernel draws with a feature. Specialized kernels know at compile time.
+    template <u8 Flags>
+    static bool KernelHas(const LineState& line, u8 flag) {
+        if constexpr ((Flags & LineKernelFlags::Generic) != 0) {
+            return (line.GetKernelFlags() & flag) != 0;
+        } else {
+            return (Flags & flag) != 0;
+        }
+    }
+
+    // A kernel for every combination of flags, indexed by the flags, followed by the generic one.
+    using LineKernel = void (PPU::*)(const LineState& line);
+    template <std::size_t... Flags>
+    static constexpr std::array<LineKernel, sizeof...(Flags) + 1> MakeLineKernels(std::index_sequence<Flags...>);
+    static const std::array<LineKernel, LineKernelFlags::Generic + 1> line_kernels;
+
+    // Lines recorded since the last time the pending lines were finished. Everything in here
+    // from lines_drawn up to lines_recorded is waiting to be drawn. Both counters go back to 0
+    // whenever the pending lines are finished, and that happens at least once a frame.
+    std::array<LineState, 144> line_log {};
+    std::atomic<u32> lines_recorded = 0;
+    std::atomic<u32> lines_drawn = 0;
+
+    LineScheduling line_scheduling = LineScheduling::Immediate;
+    std::atomic<LineScheduling> pending_line_scheduling = LineScheduling::Immediate;
+
+    std::thread line_worker;
+    std::mutex line_mutex;
+    // Signalled when a line is recorded, or the worker should stop.
+    std::condition_variable line_recorded_cv;
+    // Signalled when the worker has drawn a line.
+    std::condition_variable line_drawn_cv;
+    bool stopping_line_worker = false;
+
+    void RecordLine();
+    void DrawPendingLines();
+    void LineWorker();
+    void StartLineWorker();
+    void StopLineWorker();
+
+    // The default render target, with lines packed together in the current pixel format.
+    alignas(16) Framebuffer framebuffer {};
+    bool using_internal_framebuffer = true;
+    std::array<RenderTarget, 2> render_targets {};
+    // The render target the current frame is drawn into.
+    u8 current_target = 0;
+    void ClearFramebuffer();
+
+    // Decoded tile rows, 2 bits per pixel, leftmost pixel in the lowest bits, for the tiles
+    // in both VRAM banks. Tiles are only decoded when they're used while dirty.
+    std::array<std::array<u16, 8>, 768> tile_rows {};
+    std::bitset<768> dirty_tiles = std::bitset<768>().set();
+    TileCacheStats tile_cache_stats {};
+    TileCacheStats last_frame_tile_cache_stats {};
+
+    void DecodeTile(u16 tile_index);
+    u16 GetTileRow(u16 tile_index, u8 row) {
+        if (dirty_tiles[tile_index]) {
+            DecodeTile(tile_index);
+        }
+        return tile_rows[tile_index][row];
+    }
+
+    template <typename Pixel>
+    Pixel* GetLine(u8 line) {
+        const RenderTarget& target = render_targets[current_target];
+        return reinterpret_cast<Pixel*>(target.pixels + line * target.pitch);
+    }
+
+    // A hash of everything that goes into drawing a line with the scanline renderer: the
+    // registers, the window line, the sprites, and the index and epoch of every tile the line
+    // uses. A line whose signature matches the one it was last drawn with is already in the
+    // render target, so it doesn't need drawing again. Each render target keeps its own.
+    std::array<std::array<u64, 144>, 2> line_signatures {};
+    std::array<std::bitset<144>, 2> valid_line_signatures {};
+    void InvalidateLineSignatures() {
+        for (std::bitset<144>& valid : valid_line_signatures) {
+            valid.reset();
+        }
+    }
+    LineReuseStats line_reuse_stats {};
+    LineReuseStats last_frame_line_reuse_stats {};
+
+    // The tile a tile map entry points at, and its CGB attributes (always 0 on DMG lines).
+    struct CellTile {
+        u16 tile_index;
+        u8 attributes;
+    };
+    template <u8 Flags>
+    CellTile GetCellTile(const LineState& line, u16 tile_map_offset, u16 cell) const;
+
+    template <u8 Flags>
+    u64 ComputeLineSignature(const LineState& line) const;
+    template <u8 Flags>
+    bool IsWindowVisible(const LineState& line) const;
+
+    // The scanline renderer draws the background and window as color indices into bg_line,
+    // and the sprites into obj_line (see Scanline::OBJ_BEHIND_BG, or Scanline::CGB_PRIORITY
+    // on CGB lines), then composes the two into the framebuffer in one pass.
+    alignas(16) std::array<u8, 160> bg_line {};
+    alignas(16) std::array<u8, 160> obj_line {};
+
+    void RenderScanline(const LineState& line);
+    template <u8 Flags>
+    void RenderLine(const LineState& line);
+    template <u8 Flags>
+    void RenderBackgroundScanline(const LineState& line);
+    template <u8 Flags>
+    void RenderWindowScanline(const LineState& line);
+    template <u8 Flags>
+    void RenderSpriteScanline(const LineState& line);
+    template <u8 Flags, typename Pixel>
+    void ComposeScanline(const LineState& line);
+
+    // Both tile maps prerendered as 256x256 planes of color indices (CGB line buffer colors
+    // in CGB mode). Each 8x8 cell remembers which tile it was drawn with, that tile's epoch and
+    // the cell's attributes, so cells whose tile map entry or tile data changed since are redrawn
+    // the next time a line needs them.
+    struct BackgroundPlane {
+        std::vector<u8> indices;
+        std::array<u16, 32 * 32> cell_tiles {};
+        std::array<u32, 32 * 32> cell_epochs {};
+        std::array<u8, 32 * 32> cell_attributes {};
+    };
 
-    void RenderScanline();
-    void RenderBackgroundScanline();
-    void RenderWindowScanline();
-    void RenderSpriteScanline();
+    static constexpr u16 INVALID_CELL = 0xFFFF;
+    std::array<BackgroundPlane, 2> bg_planes {};
+    // Bumped on every write to a tile's data.
+    std::array<u32, 768> tile_epochs {};
 
+    void InvalidateBackgroundPlanes();
+    template <u8 Flags>
+    const u8* PreparePlaneRow(const LineState& line, u16 tile_map_offset, u8 y, u8 first_column, u8 columns);
+    void DrawPlaneCell(BackgroundPlane& plane, u16 cell, CellTile tile);
+
+    // State for the pixel FIFO renderer, which runs a dot at a time during mode 3.
+    // Both FIFOs are shift registers with the next pixel to be popped in the lowest bits.
     struct PixelFIFO {
-        std::array<Color, 8> data {};
-        u8 size {};
-        u8 fetcher_x {};
-        u8 fetcher_y {};
-        u16 tile_index {};
-        u16 cycles {};
-        u16 tile_index_address {};
-        u16 tile_data_address {};
-        u8 tile_data[2] = {};
-
-        u16 draw_x {};
-
-        enum class State {
-            GetTile_Cycle1,
-            GetTile_Cycle2,
-            GetTileDataLow_Cycle1,
-            GetTileDataLow_Cycle2,
-            GetTileDataHigh_Cycle1,
-            GetTileDataHigh_Cycle2,
-            Sleep_Cycle1,
-            Sleep_Cycle2,
+        enum class FetchStep {
+            Tile,
+            DataLow,
+            DataHigh,
             Push,
-        } state;
-
-        void Reset() {
-            data = {};
-            size = 0;
-            state = State::GetTile_Cycle1;
-            draw_x = 0;
-        }
+        };
+
+        // Background/window pixels, 2 bits each.
+        u16 bg_pixels = 0;
+        u8 bg_count = 0;
+
+        // Sprite pixels, 2 bits each, plus the palette and BG-over-OBJ bits of each pixel.
+        // Transparent pixels are 0, so this is always treated as full.
+        u16 obj_pixels = 0;
+        u8 obj_palettes = 0;
+        u8 obj_priorities = 0;
+
+        FetchStep step = FetchStep::Tile;
+        u8 step_dots = 0;
+        u8 fetcher_x = 0;
+        u8 tile_id = 0;
+        u16 tile_row = 0;
+
+        // Dots left before the first fetch of the line starts.
+        u8 startup_dots = 0;
+        // Pixels at the start of the line that are dropped for fine horizontal scrolling.
+        u8 discard = 0;
+        u8 lcd_x = 0;
+
+        bool window_active = false;
+        bool fetching_window = false;
+
+        u8 next_sprite = 0;
+        bool fetching_sprite = false;
+        u8 sprite_fetch_dots = 0;
     };
 
-    PixelFIFO bg_fifo {};
-    PixelFIFO obj_fifo {};
+    PixelFIFO fifo {};
+
+    void StartPixelFIFOLine();
+    void TickPixelFIFO();
+    void StepBackgroundFetcher();
+    void LoadSpriteIntoFIFO(const Sprite& sprite);
+    void OutputFIFOPixel(u8 bg_index, u8 obj_index, bool use_obp1, bool bg_over_obj);
+
+    // How long mode 3 lasted on this line. HBlank makes up the rest of the line.
+    u32 mode3_length = 0;
 
-    void RunFIFO(PixelFIFO& fifo);
+    Renderer renderer = Renderer::Scanline;
+    std::atomic<Renderer> pending_renderer = Renderer::Scanline;
 
     u8 window_line_counter = 0;
 
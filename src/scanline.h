@@ -0,0 +1,304 @@
+#pragma once
+
+#include <array>
+#include <cstring>
+#include "common/types.h"
+
+#if defined(__SSSE3__) || defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+// Building blocks for rendering a tile row (8 pixels) at a time instead of a pixel at a time.
+namespace Scanline {
+
+namespace Detail {
+
+// Spreads the 8 bits of a bitplane byte out into 8 bytes, leftmost pixel (bit 7) in the lowest byte.
+constexpr std::array<u64, 256> GenerateBitplaneTable() {
+    std::array<u64, 256> table {};
+    for (u32 byte = 0; byte < 256; byte++) {
+        for (u32 pixel = 0; pixel < 8; pixel++) {
+            const u64 bit = (byte >> (7 - pixel)) & 1;
+            table[byte] |= bit << (pixel * 8);
+        }
+    }
+    return table;
+}
+
+inline constexpr std::array<u64, 256> bitplane_table = GenerateBitplaneTable();
+
+// Spreads the 8 bits of a bitplane byte out to every other bit, leftmost pixel (bit 7) in bit 0.
+constexpr std::array<u16, 256> GeneratePackTable() {
+    std::array<u16, 256> table {};
+    for (u32 byte = 0; byte < 256; byte++) {
+        for (u32 pixel = 0; pixel < 8; pixel++) {
+            const u16 bit = (byte >> (7 - pixel)) & 1;
+            table[byte] |= bit << (pixel * 2);
+        }
+    }
+    return table;
+}
+
+// Spreads 4 packed 2-bit indices out into 4 bytes.
+constexpr std::array<u32, 256> GenerateUnpackTable() {
+    std::array<u32, 256> table {};
+    for (u32 byte = 0; byte < 256; byte++) {
+        for (u32 pixel = 0; pixel < 4; pixel++) {
+            table[byte] |= ((byte >> (pixel * 2)) & 0b11) << (pixel * 8);
+        }
+    }
+    return table;
+}
+
+inline constexpr std::array<u16, 256> pack_table = GeneratePackTable();
+inline constexpr std::array<u32, 256> unpack_table = GenerateUnpackTable();
+
+}
+
+// Interleaves the two bitplanes of a tile row into 8 color indices, one per byte,
+// with the leftmost pixel in the lowest byte.
+inline u64 DecodeTileRow(u8 low, u8 high) {
+#if defined(__BMI2__)
+    // PDEP puts the rightmost pixel (bit 0) in the lowest byte, so swap the bytes around afterwards.
+    const u64 low_bits = _pdep_u64(low, 0x0101010101010101);
+    const u64 high_bits = _pdep_u64(high, 0x0202020202020202);
+    return __builtin_bswap64(low_bits | high_bits);
+#else
+    return Detail::bitplane_table[low] | (Detail::bitplane_table[high] << 1);
+#endif
+}
+
+// Interleaves the two bitplanes of a tile row into 8 packed 2-bit color indices,
+// with the leftmost pixel in the lowest 2 bits.
+inline u16 PackTileRow(u8 low, u8 high) {
+    return Detail::pack_table[low] | (Detail::pack_table[high] << 1);
+}
+
+// Mirrors a packed tile row horizontally.
+inline u16 FlipTileRow(u16 packed) {
+    packed = ((packed & 0x3333) << 2) | ((packed >> 2) & 0x3333);
+    packed = ((packed & 0x0F0F) << 4) | ((packed >> 4) & 0x0F0F);
+    return (packed << 8) | (packed >> 8);
+}
+
+// Expands a packed tile row into the one-index-per-byte layout DecodeTileRow produces.
+inline u64 UnpackTileRow(u16 packed) {
+#if defined(__BMI2__)
+    return _pdep_u64(packed, 0x0303030303030303);
+#else
+    return Detail::unpack_table[packed & 0xFF] | (static_cast<u64>(Detail::unpack_table[packed >> 8]) << 32);
+#endif
+}
+
+// A palette's 4 output pixels packed back to back, so it can be used directly as a byte
+// shuffle table. Only the first 4 * sizeof(Pixel) bytes are used.
+using PaletteLUT = std::array<u8, 16>;
+
+template <typename Pixel>
+void SetPaletteEntry(PaletteLUT& lut, u8 index, Pixel pixel) {
+    std::memcpy(&lut[index * sizeof(Pixel)], &pixel, sizeof(Pixel));
+}
+
+template <typename Pixel>
+Pixel GetPaletteEntry(const PaletteLUT& lut, u8 index) {
+    Pixel pixel;
+    std::memcpy(&pixel, &lut[index * sizeof(Pixel)], sizeof(Pixel));
+    return pixel;
+}
+
+// Maps 8 color indices through a palette and writes 8 pixels.
+template <typename Pixel>
+void ApplyPaletteScalar(u64 indices, const PaletteLUT& lut, Pixel* out) {
+    for (u32 pixel = 0; pixel < 8; pixel++) {
+        out[pixel] = GetPaletteEntry<Pixel>(lut, (indices >> (pixel * 8)) & 0b11);
+    }
+}
+
+#if defined(__SSSE3__)
+template <typename Pixel>
+void ApplyPaletteSSSE3(u64 indices, const PaletteLUT& lut, Pixel* out) {
+    static_assert(sizeof(Pixel) == 1 || sizeof(Pixel) == 2 || sizeof(Pixel) == 4);
+
+    const __m128i table = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lut.data()));
+    const __m128i index_bytes = _mm_cvtsi64_si128(static_cast<long long>(indices));
+
+    if constexpr (sizeof(Pixel) == 1) {
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(table, index_bytes));
+    } else if constexpr (sizeof(Pixel) == 2) {
+        // Repeat each index for both bytes of its pixel, then turn it into a byte offset into the table.
+        const __m128i spread = _mm_shuffle_epi8(index_bytes, _mm_setr_epi8(0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7));
+        const __m128i offsets = _mm_add_epi8(_mm_add_epi8(spread, spread), _mm_setr_epi8(0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(table, offsets));
+    } else {
+        const __m128i byte_in_pixel = _mm_setr_epi8(0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3);
+        const __m128i spread_low = _mm_shuffle_epi8(index_bytes, _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3));
+        const __m128i spread_high = _mm_shuffle_epi8(index_bytes, _mm_setr_epi8(4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7));
+        const __m128i offsets_low = _mm_add_epi8(_mm_slli_epi16(spread_low, 2), byte_in_pixel);
+        const __m128i offsets_high = _mm_add_epi8(_mm_slli_epi16(spread_high, 2), byte_in_pixel);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_shuffle_epi8(table, offsets_low));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), _mm_shuffle_epi8(table, offsets_high));
+    }
+}
+#endif
+
+template <typename Pixel>
+void ApplyPalette(u64 indices, const PaletteLUT& lut, Pixel* out) {
+#if defined(__SSSE3__)
+    ApplyPaletteSSSE3(indices, lut, out);
+#else
+    ApplyPaletteScalar(indices, lut, out);
+#endif
+}
+
+// The output pixel for every color a composed line can use: 0-3 are the background/window
+// palette, 4-7 OBP0 and 8-11 OBP1. Stored as byte planes (byte N of every pixel together),
+// so each plane can be used directly as a byte shuffle table. Only the first sizeof(Pixel)
+// planes are used.
+using CompositionLUT = std::array<std::array<u8, 16>, 4>;
+
+template <typename Pixel>
+void SetCompositionEntry(CompositionLUT& lut, u8 color, Pixel pixel) {
+    for (u32 byte = 0; byte < sizeof(Pixel); byte++) {
+        lut[byte][color] = static_cast<u8>(pixel >> (byte * 8));
+    }
+}
+
+template <typename Pixel>
+Pixel GetCompositionEntry(const CompositionLUT& lut, u8 color) {
+    Pixel pixel = 0;
+    for (u32 byte = 0; byte < sizeof(Pixel); byte++) {
+        pixel |= static_cast<Pixel>(lut[byte][color]) << (byte * 8);
+    }
+    return pixel;
+}
+
+// Sprite line buffers hold 0 where there's no sprite pixel, otherwise the sprite's color (4-11),
+// plus this flag if the sprite is behind background colors 1-3.
+inline constexpr u8 OBJ_BEHIND_BG = 0x10;
+
+inline u8 SelectColor(u8 bg, u8 obj) {
+    const bool show_obj = obj != 0 && !((obj & OBJ_BEHIND_BG) && bg != 0);
+    return show_obj ? obj & 0x0F : bg;
+}
+
+// Picks the visible color of every pixel from a background/window line buffer and a sprite
+// line buffer, and writes the output pixels.
+template <typename Pixel>
+void ComposeLineScalar(const u8* bg, const u8* obj, const CompositionLUT& lut, Pixel* out, u32 count) {
+    for (u32 x = 0; x < count; x++) {
+        out[x] = GetCompositionEntry<Pixel>(lut, SelectColor(bg[x], obj[x]));
+    }
+}
+
+#if defined(__SSSE3__)
+// Like ComposeLineScalar, 16 pixels at a time. count must be a multiple of 16.
+template <typename Pixel>
+void ComposeLineSSSE3(const u8* bg, const u8* obj, const CompositionLUT& lut, Pixel* out, u32 count) {
+    static_assert(sizeof(Pixel) == 1 || sizeof(Pixel) == 2 || sizeof(Pixel) == 4);
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i all_ones = _mm_cmpeq_epi8(zero, zero);
+    const __m128i behind_flag = _mm_set1_epi8(OBJ_BEHIND_BG);
+    const __m128i color_mask = _mm_set1_epi8(0x0F);
+
+    __m128i tables[sizeof(Pixel)];
+    for (u32 byte = 0; byte < sizeof(Pixel); byte++) {
+        tables[byte] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lut[byte].data()));
+    }
+
+    for (u32 x = 0; x < count; x += 16) {
+        const __m128i bg_colors = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bg + x));
+        const __m128i obj_pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(obj + x));
+
+        // The background shows through where there's no sprite pixel, or the sprite is behind a non-zero color.
+        const __m128i transparent = _mm_cmpeq_epi8(obj_pixels, zero);
+        const __m128i in_front = _mm_cmpeq_epi8(_mm_and_si128(obj_pixels, behind_flag), zero);
+        const __m128i bg_zero = _mm_cmpeq_epi8(bg_colors, zero);
+        const __m128i hidden = _mm_xor_si128(_mm_or_si128(in_front, bg_zero), all_ones);
+        const __m128i show_bg = _mm_or_si128(transparent, hidden);
+        const __m128i colors = _mm_or_si128(_mm_and_si128(show_bg, bg_colors),
+                                            _mm_andnot_si128(show_bg, _mm_and_si128(obj_pixels, color_mask)));
+
+        __m128i* dest = reinterpret_cast<__m128i*>(out + x);
+        if constexpr (sizeof(Pixel) == 1) {
+            _mm_storeu_si128(dest, _mm_shuffle_epi8(tables[0], colors));
+        } else if constexpr (sizeof(Pixel) == 2) {
+            const __m128i low = _mm_shuffle_epi8(tables[0], colors);
+            const __m128i high = _mm_shuffle_epi8(tables[1], colors);
+            _mm_storeu_si128(dest, _mm_unpacklo_epi8(low, high));
+            _mm_storeu_si128(dest + 1, _mm_unpackhi_epi8(low, high));
+        } else {
+            // Interleave the byte planes back into 32-bit pixels.
+            const __m128i byte0 = _mm_shuffle_epi8(tables[0], colors);
+            const __m128i byte1 = _mm_shuffle_epi8(tables[1], colors);
+            const __m128i byte2 = _mm_shuffle_epi8(tables[2], colors);
+            const __m128i byte3 = _mm_shuffle_epi8(tables[3], colors);
+            const __m128i low_halves_lo = _mm_unpacklo_epi8(byte0, byte1);
+            const __m128i low_halves_hi = _mm_unpackhi_epi8(byte0, byte1);
+            const __m128i high_halves_lo = _mm_unpacklo_epi8(byte2, byte3);
+            const __m128i high_halves_hi = _mm_unpackhi_epi8(byte2, byte3);
+            _mm_storeu_si128(dest, _mm_unpacklo_epi16(low_halves_lo, high_halves_lo));
+            _mm_storeu_si128(dest + 1, _mm_unpackhi_epi16(low_halves_lo, high_halves_lo));
+            _mm_storeu_si128(dest + 2, _mm_unpacklo_epi16(low_halves_hi, high_halves_hi));
+            _mm_storeu_si128(dest + 3, _mm_unpackhi_epi16(low_halves_hi, high_halves_hi));
+        }
+    }
+}
+#endif
+
+template <typename Pixel>
+void ComposeLine(const u8* bg, const u8* obj, const CompositionLUT& lut, Pixel* out, u32 count) {
+#if defined(__SSSE3__)
+    ComposeLineSSSE3(bg, obj, lut, out, count);
+#else
+    ComposeLineScalar(bg, obj, lut, out, count);
+#endif
+}
+
+// The output pixel for every color a CGB line can use: 0-31 are the 8 background palettes and
+// 32-63 the 8 sprite palettes, 4 colors each. Pixels are in the low bytes of each entry.
+using ColorLUT = std::array<u32, 64>;
+
+// CGB line buffers hold background/window colors (0-31), plus this flag if the tile's attributes put
+// it above sprites, and sprite colors (32-63, or 0 where there's no sprite pixel), plus this flag if
+// the sprite is behind background colors 1-3.
+inline constexpr u8 CGB_PRIORITY = 0x40;
+
+// With master_priority off (LCDC bit 0 clear on a CGB), sprites are always on top.
+inline u8 SelectColorCGB(u8 bg, u8 obj, bool master_priority) {
+    const bool bg_on_top = master_priority && (bg & 0b11) != 0 && ((bg | obj) & CGB_PRIORITY);
+    return (obj != 0 && !bg_on_top) ? obj & 0x3F : bg & 0x3F;
+}
+
+// Like ComposeLine, for CGB line buffers. Palettes are converted to output pixels when they're
+// written, so this is one table lookup per pixel.
+template <typename Pixel>
+void ComposeColorLine(const u8* bg, const u8* obj, const ColorLUT& lut, bool master_priority, Pixel* out, u32 count) {
+    for (u32 x = 0; x < count; x++) {
+        out[x] = static_cast<Pixel>(lut[SelectColorCGB(bg[x], obj[x], master_priority)]);
+    }
+}
+
+// A fast non-cryptographic 64-bit hash of a drawn line (or anything else). size must be a
+// multiple of 32. Four independent lanes keep the multiplies from waiting on each other.
+inline u64 HashLine(const u8* data, u32 size) {
+    constexpr u64 MULTIPLIER = 0x9E3779B97F4A7C15;
+    u64 lanes[4] = { size, size ^ 1, size ^ 2, size ^ 3 };
+    for (u32 offset = 0; offset < size; offset += 32) {
+        for (u32 lane = 0; lane < 4; lane++) {
+            u64 word;
+            std::memcpy(&word, data + offset + lane * 8, sizeof(word));
+            lanes[lane] = (lanes[lane] ^ word) * MULTIPLIER;
+            lanes[lane] ^= lanes[lane] >> 29;
+        }
+    }
+
+    u64 hash = 0;
+    for (u64 lane : lanes) {
+        hash = (hash ^ lane) * MULTIPLIER;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+}
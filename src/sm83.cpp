@@ -7,6 +7,23 @@ SM83::SM83(Bus& bus, Timer& timer)
 }
 
 void SM83::Tick() {
+    // VRAM DMA and speed switches hold the CPU up for a while.
+    if (const u64 stall = bus.TakeCPUStallCycles()) {
+        timer.AdvanceCycles(stall);
+    }
+
+    if (stopped) {
+        // STOP mode only ends when a selected button is pressed, whether or not the joypad
+        // interrupt is enabled. Time keeps passing so the frontend still gets frames to poll
+        // input on.
+        if ((bus.GetJoypad()->Read() & 0x0F) == 0x0F) {
+            timer.AdvanceCycles(4);
+            return;
+        }
+
+        stopped = false;
+    }
+
     HandleInterrupts();
 
     if (halted) {
@@ -282,7 +299,7 @@ bool SM83::ExecuteOpcode(const u8 opcode) {
         INSTR(0x0D, LTRACE("DEC C"); dec_r(&c));
         INSTR(0x0E, ld_r_d8<Registers::C>());
         INSTR(0x0F, rrca());
-        // 0x10 STOP
+        INSTR(0x10, stop());
         INSTR(0x11, ld_de_d16());
         INSTR(0x12, ld_dde_a());
         INSTR(0x13, LTRACE("INC DE"); inc_rr(&de));
@@ -800,8 +817,8 @@ bool SM83::ExecuteCBOpcode(const u8 opcode) {
 }
 
 void SM83::HandleInterrupts() {
-    u8 interrupt_flags = bus.Read8(0xFF0F, false);
-    u8 interrupt_enable = bus.Read8(0xFFFF, false);
+    u8 interrupt_flags = bus.Peek8(0xFF0F);
+    u8 interrupt_enable = bus.Peek8(0xFFFF);
     u8 potential_interrupts = interrupt_flags & interrupt_enable & 0x1F;
     if (!potential_interrupts) {
         return;
@@ -1731,7 +1748,7 @@ void SM83::swap_r(u8* reg) {
 void SM83::rst(u8 addr) {
     LTRACE("RST 0x{:02X}", addr);
 
-    if (addr == 0x0038 && bus.Read8(0x0038, false) == 0xFF) {
+    if (addr == 0x0038 && bus.Peek8(0x0038) == 0xFF) {
         LFATAL("Stack overflow");
         DumpRegisters();
         bus.DumpMemoryToFile();
@@ -1891,6 +1908,19 @@ void SM83::sub_r(u8 reg) {
     a -= reg;
 }
 
+void SM83::stop() {
+    LTRACE("STOP");
+    // The byte after STOP is skipped.
+    pc++;
+
+    if (bus.SwitchSpeed()) {
+        return;
+    }
+
+    timer.ResetDivider();
+    stopped = true;
+}
+
 void SM83::sub_d8() {
     u8 value = GetByteFromPC(); 
     LTRACE("SUB 0x{:02X}", value);
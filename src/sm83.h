@@ -28,6 +28,9 @@ public:
     void Tick();
 
     void DumpRegisters();
+
+    // Address of the instruction currently being executed.
+    u16 GetPC() const { return pc_at_opcode; }
 private:
     static_assert(std::endian::native == std::endian::little, "Only little-endian hosts are supported at the moment");
 
@@ -62,6 +65,7 @@ private:
     bool ime_delay = false; // EI enables interrupts one instruction after
 
     bool halted = false;
+    bool stopped = false;
 
     Bus& bus;
     Timer& timer;
@@ -284,6 +288,8 @@ private:
     void srl_dhl();
     void srl_r(u8* reg);
 
+    void stop();
+
     void sub_d8();
     void sub_r(u8 reg);
 
@@ -17,7 +17,7 @@ void Timer::Tick() {
         if (tima == 0) {
             tima = tma;
             // request a timer interrupt
-            bus.Write8(0xFF0F, bus.Read8(0xFF0F, false) | 0x4, false);
+            bus.Write8(0xFF0F, bus.Peek8(0xFF0F) | 0x4, false);
         }
     }
 }
@@ -69,6 +69,7 @@ u32 Timer::GetTACFrequency() {
 
 void Timer::AdvanceCycles(u64 cycles) {
     cycle_count += cycles;
+    elapsed_cycles += cycles;
 
     if (timer_enable) {
         tima_cycles += cycles;
@@ -84,5 +85,6 @@ void Timer::AdvanceCycles(u64 cycles) {
         Tick();
     }
 
-    ppu.AdvanceCycles(cycles);
+    // CPU cycles always come in whole M-cycles, so this never drops any.
+    ppu.AdvanceCycles(cycles >> ppu_cycle_shift);
 }
@@ -17,7 +17,14 @@ public:
     u8 GetTAC();
     void SetTAC(u8 value);
 
+    // Runs everything that's clocked alongside the CPU for `cycles` CPU cycles.
     void AdvanceCycles(u64 cycles);
+    u64 GetElapsedCycles() const { return elapsed_cycles; }
+
+    // In CGB double speed mode, the CPU, DIV/TIMA and OAM DMA run twice as fast, but the PPU doesn't,
+    // so it only gets half of the CPU's cycles.
+    bool IsDoubleSpeed() const { return ppu_cycle_shift != 0; }
+    void SetDoubleSpeed(bool enabled) { ppu_cycle_shift = enabled ? 1 : 0; }
 
 private:
     u32 GetTACFrequency();
@@ -30,6 +37,8 @@ private:
     bool timer_enable = false;
 
     u64 tima_cycles = 0;
+    u64 elapsed_cycles = 0;
+    u8 ppu_cycle_shift = 0;
 
     Bus& bus;
     PPU& ppu;
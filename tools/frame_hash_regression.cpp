@@ -0,0 +1,183 @@
+// Runs a cartridge headless and as fast as possible for a number of frames, and compares the hash
+// of every frame against a golden file recorded earlier (in the format of the PPU's frame hash log).
+// Without input the emulator is deterministic, so any difference means something draws differently.
+// Build with -DHELIAGE_BUILD_TOOLS=ON.
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fmt/core.h>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+#include "bootrom.h"
+#include "cartridge.h"
+#include "gb.h"
+#include "ppu.h"
+
+void HandleEvents([[maybe_unused]] Joypad* joypad) {
+}
+
+void DrawFramebuffer([[maybe_unused]] const PPU::RenderTarget& frame) {
+}
+
+struct Options {
+    std::filesystem::path bootrom_path;
+    std::filesystem::path cart_path;
+    u64 frames = 0;
+    std::filesystem::path golden_path;
+    bool update = false;
+    PPU::PixelFormat pixel_format = PPU::PixelFormat::Gray8;
+    PPU::Renderer renderer = PPU::Renderer::Scanline;
+    PPU::LineScheduling line_scheduling = PPU::LineScheduling::Immediate;
+};
+
+static void PrintUsage(const char* program) {
+    printf("usage: %s <bootrom> <cartridge> <frames> <golden file> [options]\n", program);
+    printf("  --update                                   record the golden file instead of checking it\n");
+    printf("  --format argb8888|rgba8888|rgb565|gray8    pixel format to hash (default gray8)\n");
+    printf("  --renderer scanline|fifo                   (default scanline)\n");
+    printf("  --scheduling immediate|deferred|threaded   how scanlines are drawn (default immediate)\n");
+}
+
+static std::optional<Options> ParseOptions(int argc, char* argv[]) {
+    if (argc < 5) {
+        return std::nullopt;
+    }
+
+    Options options;
+    options.bootrom_path = argv[1];
+    options.cart_path = argv[2];
+    options.frames = std::strtoull(argv[3], nullptr, 10);
+    options.golden_path = argv[4];
+
+    for (int i = 5; i < argc; i++) {
+        const std::string option = argv[i];
+        const std::string value = (i + 1 < argc) ? argv[i + 1] : "";
+        if (option == "--update") {
+            options.update = true;
+            continue;
+        }
+
+        if (option == "--format" && value == "argb8888") {
+            options.pixel_format = PPU::PixelFormat::ARGB8888;
+        } else if (option == "--format" && value == "rgba8888") {
+            options.pixel_format = PPU::PixelFormat::RGBA8888;
+        } else if (option == "--format" && value == "rgb565") {
+            options.pixel_format = PPU::PixelFormat::RGB565;
+        } else if (option == "--format" && value == "gray8") {
+            options.pixel_format = PPU::PixelFormat::Gray8;
+        } else if (option == "--renderer" && value == "scanline") {
+            options.renderer = PPU::Renderer::Scanline;
+        } else if (option == "--renderer" && value == "fifo") {
+            options.renderer = PPU::Renderer::PixelFIFO;
+        } else if (option == "--scheduling" && value == "immediate") {
+            options.line_scheduling = PPU::LineScheduling::Immediate;
+        } else if (option == "--scheduling" && value == "deferred") {
+            options.line_scheduling = PPU::LineScheduling::Deferred;
+        } else if (option == "--scheduling" && value == "threaded") {
+            options.line_scheduling = PPU::LineScheduling::Threaded;
+        } else {
+            fmt::print("invalid option {} {}\n", option, value);
+            return std::nullopt;
+        }
+        i++;
+    }
+
+    return options;
+}
+
+// Reads a frame hash log into one hash per frame number.
+static std::optional<std::vector<u64>> ReadGoldenFile(const std::filesystem::path& path) {
+    std::ifstream file(path);
+    if (!file) {
+        fmt::print("could not open golden file {}\n", path.string());
+        return std::nullopt;
+    }
+
+    std::vector<u64> hashes;
+    std::string line;
+    std::getline(file, line); // header
+    while (std::getline(file, line)) {
+        u64 frame = 0;
+        u64 hash = 0;
+        if (std::sscanf(line.c_str(), "%" SCNu64 ",%" SCNx64, &frame, &hash) != 2 || frame != hashes.size()) {
+            fmt::print("malformed golden file {} at frame {}\n", path.string(), hashes.size());
+            return std::nullopt;
+        }
+        hashes.push_back(hash);
+    }
+
+    return hashes;
+}
+
+int main(int argc, char* argv[]) {
+    std::optional<Options> options = ParseOptions(argc, argv);
+    if (!options.has_value()) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    std::optional<std::vector<u64>> golden;
+    if (!options->update) {
+        golden = ReadGoldenFile(options->golden_path);
+        if (!golden.has_value()) {
+            return 1;
+        }
+    }
+
+    BootROM bootrom(options->bootrom_path);
+    Cartridge cartridge(options->cart_path);
+    GB gb(bootrom, cartridge);
+    PPU* ppu = gb.GetPPU();
+    ppu->SetPixelFormat(options->pixel_format);
+    // These take effect from the second frame on, the first one always uses the defaults.
+    ppu->SetRenderer(options->renderer);
+    ppu->SetLineScheduling(options->line_scheduling);
+    if (options->update) {
+        ppu->SetFrameHashLog(options->golden_path);
+    }
+
+    std::vector<u64> frame_hashes;
+    const auto start = std::chrono::steady_clock::now();
+    while (frame_hashes.size() < options->frames) {
+        const u64 frame_count = ppu->GetFrameCount();
+        gb.Run();
+        if (ppu->GetFrameCount() != frame_count) {
+            frame_hashes.push_back(ppu->GetFrameHash());
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fmt::print("ran {} frames in {:.2f}s ({:.0f} fps)\n", options->frames, seconds, options->frames / seconds);
+
+    if (options->update) {
+        fmt::print("recorded {}\n", options->golden_path.string());
+        return 0;
+    }
+
+    if (golden->size() < options->frames) {
+        fmt::print("golden file only has {} frames\n", golden->size());
+        return 1;
+    }
+
+    u64 mismatches = 0;
+    for (u64 frame = 0; frame < options->frames; frame++) {
+        if (frame_hashes[frame] != (*golden)[frame]) {
+            if (mismatches == 0) {
+                fmt::print("first mismatch at frame {}: expected {:016x}, got {:016x}\n", frame, (*golden)[frame], frame_hashes[frame]);
+            }
+            mismatches++;
+        }
+    }
+
+    if (mismatches != 0) {
+        fmt::print("{} of {} frames differ\n", mismatches, options->frames);
+        return 1;
+    }
+
+    fmt::print("all {} frames match\n", options->frames);
+    return 0;
+}
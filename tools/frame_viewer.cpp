@@ -0,0 +1,155 @@
+// Shows the frames a heliage instance started with an instance name publishes to shared memory
+// (see src/frame_exporter.h), without touching the emulator process. The window title shows
+// the frame number, how fast frames are arriving, and the PPU's stats for the frame.
+// Build with -DHELIAGE_BUILD_TOOLS=ON.
+
+#include <SDL2/SDL.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <optional>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "frame_export.h"
+#include "frontend/sdl_window.h"
+#include "logging.h"
+
+SDL_Event event;
+
+bool running = false;
+
+static const FrameExport::Segment* AttachToInstance(const std::string& instance_name) {
+    const std::string segment_name = FrameExport::GetSegmentName(instance_name);
+    const int fd = shm_open(segment_name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        LFATAL("could not open shared memory {}: {}", segment_name, std::strerror(errno));
+        return nullptr;
+    }
+
+    void* mapping = mmap(nullptr, sizeof(FrameExport::Segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        LFATAL("could not map shared memory {}: {}", segment_name, std::strerror(errno));
+        return nullptr;
+    }
+
+    const auto* segment = static_cast<const FrameExport::Segment*>(mapping);
+    if (segment->magic != FrameExport::MAGIC || segment->version != FrameExport::VERSION) {
+        LFATAL("{} isn't a heliage frame export this viewer understands", segment_name);
+        munmap(mapping, sizeof(FrameExport::Segment));
+        return nullptr;
+    }
+
+    LINFO("attached to {}", segment_name);
+    return segment;
+}
+
+static u32 GetSDLPixelFormat(PPU::PixelFormat format) {
+    switch (format) {
+        case PPU::PixelFormat::RGBA8888:
+            return SDL_PIXELFORMAT_RGBA8888;
+        case PPU::PixelFormat::RGB565:
+            return SDL_PIXELFORMAT_RGB565;
+        case PPU::PixelFormat::ARGB8888:
+        case PPU::PixelFormat::Gray8:
+        default:
+            // SDL has no 8-bit grayscale format, Gray8 frames are expanded to ARGB8888.
+            return SDL_PIXELFORMAT_ARGB8888;
+    }
+}
+
+static void DrawFrame(const FrameExport::FrameInfo& info, const FrameExport::Pixels& pixels) {
+    static u32 texture_format = SDL_PIXELFORMAT_UNKNOWN;
+    const u32 format = GetSDLPixelFormat(info.pixel_format);
+    if (format != texture_format) {
+        if (!SDLWindow::CreateTexture(format, 160, 144)) {
+            running = false;
+            return;
+        }
+        texture_format = format;
+    }
+
+    if (info.pixel_format == PPU::PixelFormat::Gray8) {
+        std::array<u32, 160 * 144> expanded;
+        for (u32 i = 0; i < expanded.size(); i++) {
+            const u8 gray = pixels[i];
+            expanded[i] = 0xFF << 24 | gray << 16 | gray << 8 | gray;
+        }
+        SDL_UpdateTexture(SDLWindow::texture, nullptr, expanded.data(), 160 * sizeof(u32));
+    } else {
+        SDL_UpdateTexture(SDLWindow::texture, nullptr, pixels.data(), info.pitch);
+    }
+
+    SDLWindow::Present();
+}
+
+static void UpdateTitle(const std::string& instance_name, const FrameExport::FrameInfo& info, double frames_per_second) {
+    const std::string title = fmt::format("heliage - {} - frame {} ({:.1f} fps) - {}/{} lines reused, {} tiles decoded",
+                                          instance_name, info.frame_number, frames_per_second,
+                                          info.line_reuse_stats.lines_reused,
+                                          info.line_reuse_stats.lines_reused + info.line_reuse_stats.lines_rendered,
+                                          info.tile_cache_stats.tiles_decoded);
+    SDL_SetWindowTitle(SDLWindow::window, title.c_str());
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        printf("usage: %s <instance name>\n", argv[0]);
+        return 1;
+    }
+
+    const std::string instance_name = argv[1];
+    const FrameExport::Segment* segment = AttachToInstance(instance_name);
+    if (!segment) {
+        return 1;
+    }
+
+    if (!SDLWindow::Init()) {
+        return 1;
+    }
+
+    FrameExport::FrameInfo info {};
+    FrameExport::Pixels pixels {};
+    u64 last_frame_number = ~u64(0);
+    std::optional<u64> drawn_frame_hash;
+    u64 title_frame_number = 0;
+    u64 title_timestamp_ns = 0;
+
+    running = true;
+    while (running) {
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                running = false;
+            }
+        }
+
+        // Only the newest frame is shown, frames that arrived in between are dropped.
+        if (!FrameExport::ReadLatestFrame(*segment, info, pixels) || info.frame_number == last_frame_number) {
+            SDL_Delay(1);
+            continue;
+        }
+        last_frame_number = info.frame_number;
+
+        // Frames that look like the one on screen don't need uploading or presenting.
+        if (info.frame_hash != drawn_frame_hash) {
+            DrawFrame(info, pixels);
+            drawn_frame_hash = info.frame_hash;
+        }
+
+        if (title_timestamp_ns == 0) {
+            title_frame_number = info.frame_number;
+            title_timestamp_ns = info.timestamp_ns;
+        } else if (info.timestamp_ns - title_timestamp_ns >= 1'000'000'000) {
+            const double seconds = (info.timestamp_ns - title_timestamp_ns) / 1e9;
+            UpdateTitle(instance_name, info, (info.frame_number - title_frame_number) / seconds);
+            title_frame_number = info.frame_number;
+            title_timestamp_ns = info.timestamp_ns;
+        }
+    }
+
+    munmap(const_cast<FrameExport::Segment*>(segment), sizeof(FrameExport::Segment));
+    SDLWindow::Shutdown();
+    return 0;
+}